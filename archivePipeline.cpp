@@ -0,0 +1,383 @@
+#include "archivePipeline.h"
+#include "logger.h"
+#include "compressedWriter.h"
+#include "storageManager.h"
+#include "telemetrySchema.h"
+#include "metrics.h"
+#include <thread>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+// Uncompressed CSV block handed from export to compress
+constexpr size_t BLOCK_SIZE = 1024 * 1024;
+}
+
+ArchivePipeline::ArchivePipeline(const DbConfig& dbConfig, const std::string& tableName,
+                                 const std::string& outputFolder, size_t concurrency, ArchiveFormat format,
+                                 const ExportOptions& exportOptions)
+    : m_dbConfig(dbConfig)
+    , m_tableName(tableName)
+    , m_outputFolder(outputFolder)
+    , m_concurrency(concurrency > 0 ? concurrency : 1)
+    , m_format(format)
+    , m_exportOptions(exportOptions)
+    , m_nextJob(0)
+    , m_maxQueuedBlocks(2 * m_concurrency)
+    , m_exportFinished(false) {}
+
+std::vector<std::string> ArchivePipeline::run(const std::vector<std::string>& partitions,
+                                              const ArchivedCallback& onArchived) {
+    std::vector<std::string> failedPartitions;
+    if (partitions.empty()) {
+        return failedPartitions;
+    }
+
+    m_jobs.clear();
+    for (const auto& partition : partitions) {
+        auto job = std::make_unique<PartitionJob>();
+        job->name = partition;
+        // Archives are grouped into YYYYMM folders, as for the sequential export
+        job->path = m_outputFolder + "/" + partition.substr(1, 6) + "/" + partition +
+                    (m_format == ArchiveFormat::Columnar ? COLUMN_ARCHIVE_EXTENSION : ".csv.gz");
+        job->tempPath = job->path + ".part";
+        m_jobs.push_back(std::move(job));
+    }
+    m_nextJob = 0;
+    m_exportFinished = false;
+
+    size_t exportThreads = std::min(m_concurrency, partitions.size());
+    std::vector<std::thread> exporters;
+    std::vector<std::thread> compressors;
+    for (size_t i = 0; i < exportThreads; ++i) {
+        exporters.emplace_back(&ArchivePipeline::exportWorker, this);
+    }
+    for (size_t i = 0; i < m_concurrency; ++i) {
+        compressors.emplace_back(&ArchivePipeline::compressWorker, this);
+    }
+
+    // Collect durable archives as they complete. Their partitions are only
+    // dropped once every exporter has finished: a DROP PARTITION waiting for
+    // the metadata lock behind another exporter's SELECT would hold up every
+    // INSERT into the table behind it.
+    std::vector<std::string> archived;
+    for (size_t done = 0; done < partitions.size(); ++done) {
+        PartitionJob* job;
+        {
+            std::unique_lock<std::mutex> lock(m_completedMutex);
+            m_completedAvailable.wait(lock, [this] { return !m_completed.empty(); });
+            job = m_completed.front();
+            m_completed.pop_front();
+        }
+
+        if (job->failed) {
+            LOG_ERROR("Failed to archive partition: " << job->name);
+            failedPartitions.push_back(job->name);
+            continue;
+        }
+
+        LOG_INFO("Archived partition " << job->name << " to " << job->path);
+        archived.push_back(job->name);
+    }
+
+    for (auto& thread : exporters) {
+        thread.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_blockMutex);
+        m_exportFinished = true;
+    }
+    m_blockAvailable.notify_all();
+    for (auto& thread : compressors) {
+        thread.join();
+    }
+
+    // Drop stage: no reads of the table are left open
+    for (const auto& partition : archived) {
+        try {
+            onArchived(partition);
+        } catch (const std::exception& e) {
+            LOG_ERROR("Error after archiving partition " << partition << ": " << e.what());
+            failedPartitions.push_back(partition);
+        }
+    }
+
+    m_jobs.clear();
+    return failedPartitions;
+}
+
+// Export stage: claim partitions one at a time on this thread's own connection
+void ArchivePipeline::exportWorker() {
+    mysql_thread_init();
+    MYSQL* conn = openConnection(m_dbConfig);
+
+    while (true) {
+        PartitionJob* job;
+        {
+            std::lock_guard<std::mutex> lock(m_jobMutex);
+            if (m_nextJob >= m_jobs.size()) {
+                break;
+            }
+            job = m_jobs[m_nextJob++].get();
+        }
+
+        if (conn != NULL) {
+            StageTimer timer(pipelineMetrics().exportPartition);
+            exportPartition(conn, *job);
+        } else {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->failed = true;
+        }
+
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->exportDone = true;
+        finishIfComplete(*job);
+    }
+
+    if (conn != NULL) {
+        mysql_close(conn);
+    }
+    mysql_thread_end();
+}
+
+void ArchivePipeline::exportPartition(MYSQL* conn, PartitionJob& job) {
+    try {
+        createDirectory(m_outputFolder + "/" + job.name.substr(1, 6));
+    } catch (const std::exception& e) {
+        LOG_ERROR(e.what());
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.failed = true;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.fd = ::open(job.tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (job.fd == -1) {
+            LOG_ERROR("Failed to open file for writing: " << job.tempPath);
+            job.failed = true;
+            return;
+        }
+    }
+
+    bool columnar = m_format == ArchiveFormat::Columnar;
+    if (columnar) {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        if (!writeToJob(job, encodeArchiveHeader(snapshotColumns()))) {
+            return;
+        }
+    }
+
+    PartitionReader reader(conn, m_tableName, job.name, columnar ? columnarSelectList() : telemetryColumnList(),
+                           m_exportOptions);
+
+    Block block{&job, 0, {}, {}};
+    const int numFields = TELEMETRY_COLUMN_COUNT;
+    if (columnar) {
+        block.rows.reserve(COLUMN_BLOCK_ROWS);
+    } else {
+        block.data.reserve(BLOCK_SIZE + 4096);
+
+        // Write headers
+        for (int i = 0; i < numFields; ++i) {
+            block.data.insert(block.data.end(), TELEMETRY_COLUMNS[i], TELEMETRY_COLUMNS[i] + std::strlen(TELEMETRY_COLUMNS[i]));
+            block.data.push_back(i < numFields - 1 ? ',' : '\n');
+        }
+    }
+
+    // Write rows, handing over a block whenever one fills up
+    MYSQL_ROW row;
+    unsigned long* lengths;
+    while (reader.next(row, lengths)) {
+        if (columnar) {
+            block.rows.emplace_back();
+            snapshotFromRow(row, lengths, block.rows.back());
+            if (block.rows.size() >= COLUMN_BLOCK_ROWS) {
+                pushBlock(std::move(block));
+                block = Block{&job, 0, {}, {}};
+                block.rows.reserve(COLUMN_BLOCK_ROWS);
+            }
+            continue;
+        }
+
+        for (int i = 0; i < numFields; ++i) {
+            if (row[i]) {
+                block.data.insert(block.data.end(), row[i], row[i] + lengths[i]);
+            }
+            block.data.push_back(i < numFields - 1 ? ',' : '\n');
+        }
+        if (block.data.size() >= BLOCK_SIZE) {
+            pushBlock(std::move(block));
+            block = Block{&job, 0, {}, {}};
+            block.data.reserve(BLOCK_SIZE + 4096);
+        }
+    }
+
+    if (!reader.error().empty()) {
+        LOG_ERROR(reader.error());
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.failed = true;
+        return;
+    }
+    if (!block.data.empty() || !block.rows.empty()) {
+        pushBlock(std::move(block));
+    }
+}
+
+// Queue a block for compression, waiting while the compress stage is full
+void ArchivePipeline::pushBlock(Block block) {
+    {
+        std::lock_guard<std::mutex> lock(block.job->mutex);
+        block.sequence = block.job->blocksProduced++;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_blockMutex);
+        m_blockSpace.wait(lock, [this] { return m_blocks.size() < m_maxQueuedBlocks; });
+        m_blocks.push_back(std::move(block));
+    }
+    m_blockAvailable.notify_one();
+}
+
+// Compress stage: turn blocks into gzip members or encoded column blocks
+void ArchivePipeline::compressWorker() {
+    while (true) {
+        Block block;
+        {
+            std::unique_lock<std::mutex> lock(m_blockMutex);
+            m_blockAvailable.wait(lock, [this] { return !m_blocks.empty() || m_exportFinished; });
+            if (m_blocks.empty()) {
+                break;
+            }
+            block = std::move(m_blocks.front());
+            m_blocks.pop_front();
+        }
+        m_blockSpace.notify_one();
+
+        bool skip;
+        {
+            std::lock_guard<std::mutex> lock(block.job->mutex);
+            skip = block.job->failed;
+        }
+
+        EncodedBlock encoded;
+        bool succeeded = false;
+        if (!skip) {
+            try {
+                StageTimer timer(pipelineMetrics().compressBlock);
+                if (m_format == ArchiveFormat::Columnar) {
+                    encoded.data = encodeArchiveBlock(block.rows.data(), block.rows.size(), encoded.index);
+                } else {
+                    gzipCompress(block.data.data(), block.data.size(), encoded.data);
+                }
+                succeeded = true;
+            } catch (const std::exception& e) {
+                LOG_ERROR("Failed to compress block of " << block.job->name << ": " << e.what());
+            }
+        }
+        blockDone(*block.job, block.sequence, succeeded ? &encoded : nullptr);
+    }
+}
+
+// Append every block that is now in order; a null block marks the job failed
+void ArchivePipeline::blockDone(PartitionJob& job, size_t sequence, EncodedBlock* encoded) {
+    std::lock_guard<std::mutex> lock(job.mutex);
+    if (encoded == nullptr) {
+        job.failed = true;
+        job.compressed[sequence];
+    } else {
+        job.compressed[sequence] = std::move(*encoded);
+    }
+
+    for (auto it = job.compressed.find(job.nextBlock); it != job.compressed.end();
+         it = job.compressed.find(job.nextBlock)) {
+        if (!job.failed && m_format == ArchiveFormat::Columnar) {
+            // Chunk offsets become absolute once the block's place in the file is known
+            BlockIndex& index = it->second.index;
+            for (auto& chunk : index.chunks) {
+                chunk.offset += job.offset;
+            }
+            job.index.push_back(std::move(index));
+        }
+        if (!job.failed) {
+            writeToJob(job, it->second.data);
+        }
+        job.compressed.erase(it);
+        ++job.nextBlock;
+    }
+
+    finishIfComplete(job);
+}
+
+// With job.mutex held: append to the archive, marking the job failed on error
+bool ArchivePipeline::writeToJob(PartitionJob& job, const std::vector<unsigned char>& bytes) {
+    const unsigned char* data = bytes.data();
+    size_t size = bytes.size();
+    while (size > 0) {
+        ssize_t written = ::write(job.fd, data, size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("Failed to write to: " << job.tempPath);
+            job.failed = true;
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    job.offset += bytes.size();
+    pipelineMetrics().archivedBytes.add(bytes.size());
+    return true;
+}
+
+// With job.mutex held: once every block is written, make the archive durable and hand it to the drop stage
+void ArchivePipeline::finishIfComplete(PartitionJob& job) {
+    if (job.finished || !job.exportDone || job.nextBlock != job.blocksProduced) {
+        return;
+    }
+    job.finished = true;
+
+    if (!job.failed && m_format == ArchiveFormat::Columnar) {
+        writeToJob(job, encodeArchiveFooter(job.index, job.offset));
+    }
+
+    if (!job.failed) {
+        bool synced = ::fsync(job.fd) == 0;
+        bool closed = ::close(job.fd) == 0;
+        job.fd = -1;
+        if (!synced || !closed) {
+            LOG_ERROR("Failed to sync: " << job.tempPath);
+            job.failed = true;
+        } else {
+            if (std::rename(job.tempPath.c_str(), job.path.c_str()) != 0) {
+                job.failed = true;
+            } else {
+                try {
+                    syncDirectory(job.path);
+                } catch (const std::exception& e) {
+                    LOG_ERROR(e.what());
+                    job.failed = true;
+                }
+            }
+        }
+    }
+
+    if (job.failed) {
+        if (job.fd != -1) {
+            ::close(job.fd);
+            job.fd = -1;
+        }
+        std::remove(job.tempPath.c_str());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_completedMutex);
+        m_completed.push_back(&job);
+    }
+    m_completedAvailable.notify_one();
+}
@@ -0,0 +1,100 @@
+#ifndef ARCHIVE_PIPELINE_H
+#define ARCHIVE_PIPELINE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "dbConnection.h"
+#include "columnArchive.h"
+#include "partitionReader.h"
+
+// Archives several partitions at once in three stages:
+//   export   - one thread and one DB connection per worker, reading rows
+//              (see PartitionReader) into fixed-size CSV blocks, or row
+//              groups for columnar archives
+//   compress - a worker pool turning each block into a gzip member or an
+//              encoded column block, written to the archive in block order
+//   drop     - the calling thread, once every archive is fsync'd and no
+//              export is reading the table any more
+class ArchivePipeline {
+public:
+    // Called on the thread that runs run() for each partition whose archive is
+    // durable, after all exports have finished
+    using ArchivedCallback = std::function<void(const std::string& partitionName)>;
+
+    ArchivePipeline(const DbConfig& dbConfig, const std::string& tableName, const std::string& outputFolder,
+                    size_t concurrency, ArchiveFormat format = ArchiveFormat::CsvGzip,
+                    const ExportOptions& exportOptions = ExportOptions());
+
+    // Archive every partition; returns the partitions that could not be archived
+    std::vector<std::string> run(const std::vector<std::string>& partitions, const ArchivedCallback& onArchived);
+
+private:
+    struct EncodedBlock {
+        std::vector<unsigned char> data;
+        BlockIndex index;               ///< Columnar only; offsets relative to the block
+    };
+
+    struct PartitionJob {
+        std::string name;
+        std::string path;           ///< Final archive path
+        std::string tempPath;       ///< Written here, renamed once complete
+        int fd = -1;
+        uint64_t offset = 0;        ///< Bytes written to the file so far
+        std::vector<BlockIndex> index;  ///< Columnar archives: blocks written so far
+
+        std::mutex mutex;
+        size_t blocksProduced = 0;
+        size_t nextBlock = 0;       ///< Next block to append to the file
+        bool exportDone = false;
+        bool failed = false;
+        bool finished = false;
+        std::map<size_t, EncodedBlock> compressed;    ///< Out-of-order blocks
+    };
+
+    struct Block {
+        PartitionJob* job;
+        size_t sequence;
+        std::vector<char> data;         ///< CSV text
+        std::vector<Snapshot> rows;     ///< Columnar row group
+    };
+
+    void exportWorker();
+    void compressWorker();
+    void exportPartition(MYSQL* conn, PartitionJob& job);
+    void pushBlock(Block block);
+    void blockDone(PartitionJob& job, size_t sequence, EncodedBlock* encoded);
+    bool writeToJob(PartitionJob& job, const std::vector<unsigned char>& bytes);
+    void finishIfComplete(PartitionJob& job);
+
+    DbConfig m_dbConfig;
+    std::string m_tableName;
+    std::string m_outputFolder;
+    size_t m_concurrency;
+    ArchiveFormat m_format;
+    ExportOptions m_exportOptions;
+
+    std::vector<std::unique_ptr<PartitionJob>> m_jobs;
+    size_t m_nextJob;
+    std::mutex m_jobMutex;
+
+    // Bounded hand-off from export to compress
+    std::deque<Block> m_blocks;
+    size_t m_maxQueuedBlocks;
+    bool m_exportFinished;
+    std::mutex m_blockMutex;
+    std::condition_variable m_blockAvailable;
+    std::condition_variable m_blockSpace;
+
+    // Completed partitions waiting for the drop stage
+    std::deque<PartitionJob*> m_completed;
+    std::mutex m_completedMutex;
+    std::condition_variable m_completedAvailable;
+};
+
+#endif // ARCHIVE_PIPELINE_H
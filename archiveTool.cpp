@@ -0,0 +1,162 @@
+// luxarchive: inspect and query columnar partition archives (.lxc)
+//
+//   luxarchive <archive> --info
+//   luxarchive <archive> [--from TIME] [--to TIME] [--columns a,b,...]
+//
+// TIME is epoch milliseconds or local "YYYY-MM-DD HH:MM:SS". Matching rows
+// are written to stdout as CSV; only blocks overlapping the range and the
+// requested columns are decompressed.
+
+#include "columnArchive.h"
+#include "localTimeCache.h"
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+
+namespace {
+
+void printUsage() {
+    std::cerr << "Usage: luxarchive <archive.lxc> [--info] [--from TIME] [--to TIME] [--columns a,b,...]\n"
+              << "  TIME is epoch milliseconds or \"YYYY-MM-DD HH:MM:SS\" local time" << std::endl;
+}
+
+uint64_t parseTime(const std::string& text) {
+    if (!text.empty() && text.find_first_not_of("0123456789") == std::string::npos) {
+        return std::strtoull(text.c_str(), nullptr, 10);
+    }
+
+    std::tm time{};
+    if (std::sscanf(text.c_str(), "%d-%d-%d %d:%d:%d", &time.tm_year, &time.tm_mon, &time.tm_mday,
+                    &time.tm_hour, &time.tm_min, &time.tm_sec) < 3) {
+        throw std::runtime_error("Invalid time: " + text);
+    }
+    time.tm_year -= 1900;
+    time.tm_mon -= 1;
+    time.tm_isdst = -1;
+    std::time_t seconds = std::mktime(&time);
+    if (seconds == -1) {
+        throw std::runtime_error("Invalid time: " + text);
+    }
+    return static_cast<uint64_t>(seconds) * 1000;
+}
+
+std::vector<std::string> splitColumns(const std::string& text) {
+    std::vector<std::string> columns;
+    std::stringstream stream(text);
+    std::string column;
+    while (std::getline(stream, column, ',')) {
+        if (!column.empty()) {
+            columns.push_back(column);
+        }
+    }
+    return columns;
+}
+
+void printInfo(const ColumnArchiveReader& archive) {
+    LocalTimeCache timeCache;
+    char from[32] = "-";
+    char to[32] = "-";
+    if (!archive.blocks().empty()) {
+        uint64_t minTimestamp = UINT64_MAX;
+        uint64_t maxTimestamp = 0;
+        for (const auto& block : archive.blocks()) {
+            minTimestamp = std::min(minTimestamp, block.minTimestamp);
+            maxTimestamp = std::max(maxTimestamp, block.maxTimestamp);
+        }
+        timeCache.format(minTimestamp, from, sizeof(from));
+        timeCache.format(maxTimestamp, to, sizeof(to));
+    }
+
+    std::cout << "Rows:   " << archive.rowCount() << "\n"
+              << "Blocks: " << archive.blocks().size() << "\n"
+              << "Range:  " << from << " .. " << to << "\n"
+              << "Columns:" << "\n";
+
+    for (size_t c = 0; c < archive.columns().size(); ++c) {
+        uint64_t stored = 0;
+        uint64_t encoded = 0;
+        for (const auto& block : archive.blocks()) {
+            stored += block.chunks[c].storedSize;
+            encoded += block.chunks[c].encodedSize;
+        }
+        std::cout << "  " << archive.columns()[c].name << ": " << stored << " bytes stored, "
+                  << encoded << " bytes encoded" << "\n";
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printUsage();
+        return 1;
+    }
+
+    std::string path = argv[1];
+    bool info = false;
+    uint64_t fromMs = 0;
+    uint64_t toMs = UINT64_MAX;
+    std::vector<std::string> columns;
+
+    try {
+        for (int i = 2; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--info") {
+                info = true;
+            } else if (arg == "--from" && i + 1 < argc) {
+                fromMs = parseTime(argv[++i]);
+            } else if (arg == "--to" && i + 1 < argc) {
+                toMs = parseTime(argv[++i]);
+            } else if (arg == "--columns" && i + 1 < argc) {
+                columns = splitColumns(argv[++i]);
+            } else {
+                printUsage();
+                return 1;
+            }
+        }
+
+        ColumnArchiveReader archive(path);
+        if (info) {
+            printInfo(archive);
+            return 0;
+        }
+
+        if (columns.empty()) {
+            for (const auto& column : archive.columns()) {
+                columns.push_back(column.name);
+            }
+        }
+        for (size_t c = 0; c < columns.size(); ++c) {
+            std::cout << columns[c] << (c + 1 < columns.size() ? ',' : '\n');
+        }
+
+        LocalTimeCache timeCache;
+        char timeText[32];
+        archive.scan(fromMs, toMs, columns, [&](const ColumnBatch& batch) {
+            for (size_t row = 0; row < batch.rows; ++row) {
+                for (size_t c = 0; c < batch.columns.size(); ++c) {
+                    const ColumnValues& values = batch.columns[c];
+                    if (values.type == ColumnType::String) {
+                        std::cout << values.strings[row];
+                    } else if (values.type == ColumnType::Timestamp &&
+                               timeCache.format(values.numbers[row], timeText, sizeof(timeText)) > 0) {
+                        std::cout << timeText;
+                    } else {
+                        std::cout << values.numbers[row];
+                    }
+                    std::cout << (c + 1 < batch.columns.size() ? ',' : '\n');
+                }
+            }
+        });
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,308 @@
+#include "batchWriter.h"
+#include "logger.h"
+#include "dbConnection.h"
+#include <mariadb/errmsg.h>
+#include <cstring>
+#include <cstddef>
+
+namespace {
+
+// Opens the transaction each batch is written in
+const char BEGIN_QUERY[] = "START TRANSACTION";
+
+// Bind an unsigned 32-bit column of the first row
+void bindField(MYSQL_BIND& bind, uint32_t& value) {
+    bind.buffer_type = MYSQL_TYPE_LONG;
+    bind.buffer = &value;
+    bind.is_unsigned = 1;
+}
+
+// Bind a DATETIME column of the first row
+void bindField(MYSQL_BIND& bind, MYSQL_TIME& value) {
+    bind.buffer_type = MYSQL_TYPE_DATETIME;
+    bind.buffer = &value;
+}
+
+// Bind a string column of the first row, with its length taken per row
+void bindField(MYSQL_BIND& bind, TelemetryString& value) {
+    bind.buffer_type = MYSQL_TYPE_STRING;
+    bind.buffer = value.data;
+    bind.buffer_length = sizeof(value.data);
+    bind.length = &value.length;
+}
+
+// Bytes a column adds to the INSERT payload
+size_t fieldBytes(uint32_t) {
+    return sizeof(uint32_t);
+}
+
+size_t fieldBytes(const TelemetryString& value) {
+    return value.length;
+}
+
+// Local DATETIME of an epoch-millisecond timestamp, for binding
+bool toMysqlTime(LocalTimeCache& timeCache, uint64_t timestampMs, MYSQL_TIME& out) {
+    const std::tm* local = timeCache.localTime(timestampMs);
+    if (local == nullptr) {
+        return false;
+    }
+
+    std::memset(&out, 0, sizeof(out));
+    out.year = local->tm_year + 1900;
+    out.month = local->tm_mon + 1;
+    out.day = local->tm_mday;
+    out.hour = local->tm_hour;
+    out.minute = local->tm_min;
+    out.second = local->tm_sec;
+    out.second_part = (timestampMs % 1000) * 1000;    // Microseconds
+    out.time_type = MYSQL_TIMESTAMP_DATETIME;
+    return true;
+}
+
+size_t rowBytes(const Snapshot& snapshot) {
+    size_t bytes = sizeof(uint64_t);    // DATETIME
+#define ROW_FIELD_BYTES(command, name, type) bytes += fieldBytes(snapshot.name);
+    TELEMETRY_FIELDS(ROW_FIELD_BYTES)
+#undef ROW_FIELD_BYTES
+    return bytes;
+}
+
+} // namespace
+
+BatchWriter::BatchWriter(MYSQL* conn, const std::string& tableName, const FlushPolicy& policy)
+    : m_conn(conn)
+    , m_stmt(nullptr)
+    , m_tableName(tableName)
+    , m_maxRows(policy.maxRows > 0 ? policy.maxRows : 1)
+    , m_maxBytes(policy.maxBytes)
+    , m_maxAge(policy.maxLatency)
+    , m_bytes(0)
+    , m_step(Step::Idle)
+    , m_result(0)
+    , m_failed(0)
+    , m_lastError(0) {
+    // Reserve once so the bound row pointers never move
+    m_rows.reserve(m_maxRows);
+
+    std::string placeholders = "?";
+    for (size_t i = 1; i < TELEMETRY_COLUMN_COUNT; ++i) {
+        placeholders += ", ?";
+    }
+    m_query = "INSERT INTO `" + m_tableName + "` (" + telemetryColumnList() +
+              ") VALUES (" + placeholders + ")";
+}
+
+BatchWriter::~BatchWriter() {
+    closeStatement();
+}
+
+void BatchWriter::append(const Snapshot& snapshot) {
+    if (m_rows.size() >= m_maxRows) {
+        // Previous flush failed and the batch is still full. The bound rows
+        // have to stay contiguous, so the new row is the one that goes.
+        LOG_ERROR_LIMITED("Batch full, dropping row");
+        return;
+    }
+
+    bool firstRow = m_rows.empty();
+
+    Row row;
+    row.data = snapshot;
+    if (!toMysqlTime(m_timeCache, snapshot.timestampMs, row.timestamp)) {
+        LOG_ERROR_LIMITED("Invalid timestamp " << snapshot.timestampMs << ", row not stored");
+        return;
+    }
+    m_rows.push_back(row);
+    m_bytes += rowBytes(snapshot);
+
+    if (firstRow) {
+        m_firstRowTime = std::chrono::steady_clock::now();
+    }
+}
+
+bool BatchWriter::due() const {
+    if (m_rows.empty()) {
+        return false;
+    }
+    return m_rows.size() >= m_maxRows || m_bytes >= m_maxBytes ||
+           std::chrono::steady_clock::now() - m_firstRowTime >= m_maxAge;
+}
+
+int BatchWriter::startFlush() {
+    m_lastError = 0;
+    if (m_rows.empty()) {
+        return 0;
+    }
+    if (m_conn == nullptr) {
+        LOG_ERROR("No database connection for " << m_rows.size() << " rows");
+        m_lastError = CR_SERVER_GONE_ERROR;
+        return 0;
+    }
+
+    if (m_stmt != nullptr) {
+        if (!bindRows()) {
+            return 0;
+        }
+        m_step = Step::Begin;
+        int status = mysql_real_query_start(&m_result, m_conn, BEGIN_QUERY, sizeof(BEGIN_QUERY) - 1);
+        return status != 0 ? status : nextStep();
+    }
+
+    // Prepare the INSERT statement once per connection
+    m_stmt = mysql_stmt_init(m_conn);
+    if (m_stmt == nullptr) {
+        LOG_ERROR("mysql_stmt_init() failed: " << mysql_error(m_conn));
+        m_lastError = mysql_errno(m_conn);
+        return 0;
+    }
+    m_step = Step::Prepare;
+    int status = mysql_stmt_prepare_start(&m_result, m_stmt, m_query.c_str(), m_query.size());
+    return status != 0 ? status : nextStep();
+}
+
+int BatchWriter::continueFlush(int events) {
+    int status = 0;
+    switch (m_step) {
+        case Step::Idle:
+            return 0;
+        case Step::Prepare:
+            status = mysql_stmt_prepare_cont(&m_result, m_stmt, events);
+            break;
+        case Step::Begin:
+            status = mysql_real_query_cont(&m_result, m_conn, events);
+            break;
+        case Step::Execute:
+            status = mysql_stmt_execute_cont(&m_result, m_stmt, events);
+            break;
+        case Step::Commit:
+            status = mysql_commit_cont(&m_failed, m_conn, events);
+            break;
+        case Step::Rollback:
+            status = mysql_rollback_cont(&m_failed, m_conn, events);
+            break;
+    }
+    return status != 0 ? status : nextStep();
+}
+
+// The current client call has finished: check it and start the next one,
+// until one has to wait for the socket or the flush is over
+int BatchWriter::nextStep() {
+    while (true) {
+        int status = 0;
+        switch (m_step) {
+            case Step::Idle:
+                return 0;
+
+            case Step::Prepare:
+                if (m_result != 0) {
+                    LOG_ERROR("Failed to prepare INSERT: " << mysql_stmt_error(m_stmt));
+                    unsigned int error = mysql_stmt_errno(m_stmt);
+                    closeStatement();
+                    return fail(error);
+                }
+                if (!bindRows()) {
+                    m_step = Step::Idle;
+                    return 0;
+                }
+                m_step = Step::Begin;
+                status = mysql_real_query_start(&m_result, m_conn, BEGIN_QUERY, sizeof(BEGIN_QUERY) - 1);
+                break;
+
+            case Step::Begin:
+                if (m_result != 0) {
+                    LOG_ERROR("START TRANSACTION failed: " << mysql_error(m_conn));
+                    return fail(mysql_errno(m_conn));
+                }
+                m_step = Step::Execute;
+                status = mysql_stmt_execute_start(&m_result, m_stmt);
+                break;
+
+            case Step::Execute:
+                if (m_result != 0) {
+                    LOG_ERROR("Batch INSERT of " << m_rows.size() << " rows failed: "
+                              << mysql_stmt_error(m_stmt));
+                    m_lastError = mysql_stmt_errno(m_stmt);
+                    if (connectionLost(m_lastError)) {
+                        return fail(m_lastError);
+                    }
+                    m_step = Step::Rollback;
+                    status = mysql_rollback_start(&m_failed, m_conn);
+                    break;
+                }
+                m_step = Step::Commit;
+                status = mysql_commit_start(&m_failed, m_conn);
+                break;
+
+            case Step::Commit:
+                if (m_failed) {
+                    LOG_ERROR("COMMIT failed: " << mysql_error(m_conn));
+                    return fail(mysql_errno(m_conn));
+                }
+                LOG_DEBUG("Inserted " << m_rows.size() << " rows into " << m_tableName);
+                m_rows.clear();
+                m_bytes = 0;
+                m_step = Step::Idle;
+                return 0;
+
+            case Step::Rollback:
+                // The statement may be unusable after a server error; prepare again next time
+                closeStatement();
+                return fail(m_lastError);
+        }
+        if (status != 0) {
+            return status;
+        }
+    }
+}
+
+void BatchWriter::bindColumns(MYSQL_BIND (&bind)[TELEMETRY_COLUMN_COUNT]) {
+    // Column order matches telemetryColumnList()
+    Row& firstRow = m_rows.front();
+    Snapshot& first = firstRow.data;
+    std::memset(bind, 0, sizeof(bind));
+    size_t column = 0;
+#define BIND_FIELD(command, name, type) bindField(bind[column++], first.name);
+    TELEMETRY_FIELDS(BIND_FIELD)
+#undef BIND_FIELD
+    bindField(bind[column], firstRow.timestamp);
+}
+
+// Point the statement at the rows of this batch
+bool BatchWriter::bindRows() {
+    MYSQL_BIND bind[TELEMETRY_COLUMN_COUNT];
+    bindColumns(bind);
+
+    unsigned int arraySize = static_cast<unsigned int>(m_rows.size());
+    size_t rowSize = sizeof(Row);
+    mysql_stmt_attr_set(m_stmt, STMT_ATTR_ARRAY_SIZE, &arraySize);
+    mysql_stmt_attr_set(m_stmt, STMT_ATTR_ROW_SIZE, &rowSize);
+
+    if (mysql_stmt_bind_param(m_stmt, bind)) {
+        LOG_ERROR("Failed to bind INSERT parameters: " << mysql_stmt_error(m_stmt));
+        m_lastError = mysql_stmt_errno(m_stmt);
+        return false;
+    }
+    return true;
+}
+
+// End a flush that left the rows in the batch
+int BatchWriter::fail(unsigned int error) {
+    m_lastError = error != 0 ? error : CR_UNKNOWN_ERROR;
+    m_step = Step::Idle;
+    return 0;
+}
+
+void BatchWriter::closeStatement() {
+    if (m_stmt != nullptr) {
+        mysql_stmt_close(m_stmt);
+        m_stmt = nullptr;
+    }
+}
+
+void BatchWriter::takeRows(const std::function<void(const Snapshot&)>& consumer) {
+    for (const auto& row : m_rows) {
+        consumer(row.data);
+    }
+    m_rows.clear();
+    m_bytes = 0;
+}
@@ -0,0 +1,88 @@
+#ifndef BATCH_WRITER_H
+#define BATCH_WRITER_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <mariadb/mysql.h>
+#include "snapshot.h"
+#include "localTimeCache.h"
+#include "flushPolicy.h"
+
+// Collects snapshots and writes them to laser_data with a single prepared
+// INSERT using MariaDB array binding, one transaction per batch. The write
+// goes through the non-blocking client API, so the caller's thread can keep
+// filling another batch while it is in flight.
+class BatchWriter {
+public:
+    // Batches are sized and aged by policy.maxRows, maxBytes and maxLatency
+    BatchWriter(MYSQL* conn, const std::string& tableName, const FlushPolicy& policy);
+    ~BatchWriter();
+
+    void append(const Snapshot& snapshot);
+
+    // True once the batch has maxRows rows or maxBytes of data, or its oldest row has waited maxLatency
+    bool due() const;
+    bool full() const { return m_rows.size() >= m_maxRows; }
+
+    // Write the batch without blocking, on a connection opened for the
+    // non-blocking API. startFlush() returns the MYSQL_WAIT_* events to wait
+    // for, or 0 once the write has finished; while it is not finished, call
+    // continueFlush() with the events that occurred. The rows must not be
+    // touched in between. A finished write has either emptied the batch or
+    // kept its rows for takeRows() or a retry, with lastError() set.
+    int startFlush();
+    int continueFlush(int events);
+    bool flushing() const { return m_step != Step::Idle; }
+    unsigned int lastError() const { return m_lastError; }
+
+    // Hand every pending row to consumer and empty the batch
+    void takeRows(const std::function<void(const Snapshot&)>& consumer);
+
+    size_t pending() const { return m_rows.size(); }
+    size_t pendingBytes() const { return m_bytes; }
+
+    // Fill bind, one entry per TELEMETRY_COLUMNS column, with the row-wise
+    // array binding of the pending rows that a flush hands to the INSERT.
+    // The rows must not change while bind is in use.
+    void bindColumns(MYSQL_BIND (&bind)[TELEMETRY_COLUMN_COUNT]);
+
+private:
+    // The timestamp is converted to a MYSQL_TIME once per row on append
+    struct Row {
+        Snapshot data;
+        MYSQL_TIME timestamp;
+    };
+
+    // Client call a flush is waiting on; one after the other they prepare
+    // the INSERT (once per connection), open a transaction, execute, and
+    // commit, or roll back after a failed execute
+    enum class Step { Idle, Prepare, Begin, Execute, Commit, Rollback };
+
+    int nextStep();
+    bool bindRows();
+    int fail(unsigned int error);
+    void closeStatement();
+
+    MYSQL* m_conn;
+    MYSQL_STMT* m_stmt;
+    std::string m_tableName;
+    std::string m_query;
+    size_t m_maxRows;
+    size_t m_maxBytes;
+    std::chrono::milliseconds m_maxAge;
+    // Row-wise binding layout: every bind points into m_rows[0] and the
+    // client library steps through the array by sizeof(Row).
+    std::vector<Row> m_rows;
+    size_t m_bytes;             ///< Column data in m_rows, as sent to the server
+    std::chrono::steady_clock::time_point m_firstRowTime;
+    LocalTimeCache m_timeCache;
+
+    Step m_step;
+    int m_result;               ///< Return value of the finished int-returning client call
+    my_bool m_failed;           ///< Return value of the finished commit or rollback
+    unsigned int m_lastError;   ///< Client or server error of the last failed flush
+};
+
+#endif // BATCH_WRITER_H
@@ -0,0 +1,225 @@
+#include <benchmark/benchmark.h>
+#include <msgpack.hpp>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "telemetryDecoder.h"
+#include "batchWriter.h"
+
+// Microbenchmarks for the per-message and per-row work of the receiver:
+// unpacking a frame, decoding it into a snapshot, reading its timestamp,
+// adding the row to an INSERT batch and binding a full batch. Every message
+// type is measured with a fixed payload shaped like what the laser publishes.
+
+namespace {
+
+constexpr uint64_t SAMPLE_TIMESTAMP_MS = 1718870400123ULL;
+
+struct MessageType {
+    const char* name;
+    uint16_t commandID;
+};
+
+const MessageType MESSAGE_TYPES[] = {
+#define BENCH_MESSAGE_TYPE(command) {#command, command},
+    TELEMETRY_MESSAGES(BENCH_MESSAGE_TYPE)
+#undef BENCH_MESSAGE_TYPE
+};
+
+using Packer = msgpack::packer<msgpack::sbuffer>;
+
+void packString(Packer& packer, const char* text) {
+    uint32_t length = static_cast<uint32_t>(std::strlen(text));
+    packer.pack_str(length);
+    packer.pack_str_body(text, length);
+}
+
+void packField(Packer& packer, const char* key, uint32_t value) {
+    packString(packer, key);
+    packer.pack_uint32(value);
+}
+
+// One message as the publisher sends it: commandID, timestamp, then the fields
+msgpack::sbuffer samplePayload(uint16_t commandID) {
+    struct Field {
+        const char* key;
+        uint32_t value;
+    };
+    std::vector<Field> fields;
+    const char* version = nullptr;
+    switch (commandID) {
+        case PARSE_LASERHEAD_FLOW:
+            fields = {{"flowRate", 1250}};
+            break;
+        case PARSE_VERSION:
+            version = "LX-FW 3.12.7 build 2291";
+            break;
+        case PARSE_POWER:
+            fields = {{"powerReading", 48213}};
+            break;
+        case PARSE_PWM_MODULATION:
+            fields = {{"frequency", 20000}, {"pulseWidth", 35}};
+            break;
+        case PARSE_DC_INFO:
+            fields = {{"dcVoltage", 48120}, {"dcCurrent", 31250}};
+            break;
+        case PARSE_RF_INFO:
+            fields = {{"channelAForwardVoltage", 3012}, {"channelAReferenceVoltage", 118},
+                      {"channelBForwardVoltage", 2987}, {"channelBReferenceVoltage", 121},
+                      {"channelCForwardVoltage", 3040}, {"channelCReferenceVoltage", 115},
+                      {"channelDForwardVoltage", 2995}, {"channelDReferenceVoltage", 119}};
+            break;
+        case PARSE_SYSTEM_INFO:
+            fields = {{"serialNumber", 240117}, {"systemType", 4}, {"duty", 65},
+                      {"tubePressure", 182}, {"wavelength", 10600}};
+            break;
+    }
+
+    msgpack::sbuffer buffer;
+    Packer packer(buffer);
+    packer.pack_map(static_cast<uint32_t>(2 + fields.size() + (version != nullptr ? 1 : 0)));
+    packField(packer, "commandID", commandID);
+    packString(packer, "timestamp");
+    packer.pack_uint64(SAMPLE_TIMESTAMP_MS);
+    for (const auto& field : fields) {
+        packField(packer, field.key, field.value);
+    }
+    if (version != nullptr) {
+        packString(packer, "version");
+        packString(packer, version);
+    }
+    return buffer;
+}
+
+bool referenceFrame(msgpack::type::object_type, std::size_t, void*) {
+    return true;
+}
+
+// A payload unpacked once, for the benchmarks that start from the map
+struct UnpackedPayload {
+    msgpack::sbuffer buffer;
+    msgpack::zone zone;
+    msgpack::object object;
+
+    explicit UnpackedPayload(uint16_t commandID)
+        : buffer(samplePayload(commandID)) {
+        std::size_t offset = 0;
+        bool referenced = false;
+        object = msgpack::unpack(zone, buffer.data(), buffer.size(), offset, referenced, referenceFrame);
+    }
+};
+
+Snapshot sampleSnapshot() {
+    Snapshot snapshot{};
+    for (const auto& type : MESSAGE_TYPES) {
+        UnpackedPayload payload(type.commandID);
+        decodeMessage(type.commandID, payload.object.via.map, snapshot);
+    }
+    snapshot.timestampMs = SAMPLE_TIMESTAMP_MS;
+    return snapshot;
+}
+
+// Receiver::receiveData: unpack into a reused zone, then find the commandID
+void BM_Unpack(benchmark::State& state, uint16_t commandID) {
+    msgpack::sbuffer buffer = samplePayload(commandID);
+    msgpack::zone zone;
+    for (auto _ : state) {
+        zone.clear();
+        std::size_t offset = 0;
+        bool referenced = false;
+        msgpack::object message = msgpack::unpack(zone, buffer.data(), buffer.size(), offset, referenced,
+                                                  referenceFrame);
+        uint16_t decodedCommand = 0;
+        const msgpack::object* commandValue = findField(message.via.map, "commandID");
+        if (commandValue != nullptr) {
+            readUint(*commandValue, decodedCommand);
+        }
+        benchmark::DoNotOptimize(decodedCommand);
+    }
+    state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+
+// DataStorage::handleMessage without the rollups: decode into the device's snapshot and take its timestamp
+void BM_HandleMessage(benchmark::State& state, uint16_t commandID) {
+    UnpackedPayload payload(commandID);
+    Snapshot snapshot{};
+    for (auto _ : state) {
+        bool known = decodeMessage(commandID, payload.object.via.map, snapshot);
+        uint64_t timestampMs = 0;
+        bool timestamped = decodeTimestamp(payload.object.via.map, timestampMs) == nullptr;
+        snapshot.timestampMs = timestampMs;
+        benchmark::DoNotOptimize(known);
+        benchmark::DoNotOptimize(timestamped);
+        benchmark::ClobberMemory();
+    }
+}
+
+// DataStorage::handleTimestamp
+void BM_HandleTimestamp(benchmark::State& state) {
+    UnpackedPayload payload(PARSE_RF_INFO);
+    for (auto _ : state) {
+        uint64_t timestampMs = 0;
+        const char* error = decodeTimestamp(payload.object.via.map, timestampMs);
+        benchmark::DoNotOptimize(error);
+        benchmark::DoNotOptimize(timestampMs);
+    }
+}
+
+// Building an INSERT batch: each row is copied and its timestamp converted
+// for binding. Nothing is sent; the batch is cleared once full.
+void BM_BatchAppend(benchmark::State& state) {
+    FlushPolicy policy;
+    BatchWriter writer(nullptr, "laser_data", policy);
+    Snapshot snapshot = sampleSnapshot();
+    for (auto _ : state) {
+        snapshot.timestampMs += 125;
+        writer.append(snapshot);
+        if (writer.pending() >= policy.maxRows) {
+            writer.takeRows([](const Snapshot&) {});
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Building one INSERT, what insertAllData's query string used to be: a
+// full batch of rows appended, then bound column by column for the array
+// execute. Nothing is sent.
+void BM_BatchBuild(benchmark::State& state) {
+    FlushPolicy policy;
+    BatchWriter writer(nullptr, "laser_data", policy);
+    Snapshot snapshot = sampleSnapshot();
+    MYSQL_BIND bind[TELEMETRY_COLUMN_COUNT];
+    for (auto _ : state) {
+        for (size_t row = 0; row < policy.maxRows; ++row) {
+            snapshot.timestampMs += 125;
+            writer.append(snapshot);
+        }
+        writer.bindColumns(bind);
+        benchmark::DoNotOptimize(bind);
+        writer.takeRows([](const Snapshot&) {});
+    }
+    state.SetItemsProcessed(state.iterations() * policy.maxRows);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    for (const auto& type : MESSAGE_TYPES) {
+        benchmark::RegisterBenchmark((std::string("BM_Unpack/") + type.name).c_str(), BM_Unpack, type.commandID);
+    }
+    for (const auto& type : MESSAGE_TYPES) {
+        benchmark::RegisterBenchmark((std::string("BM_HandleMessage/") + type.name).c_str(), BM_HandleMessage,
+                                     type.commandID);
+    }
+    benchmark::RegisterBenchmark("BM_HandleTimestamp", BM_HandleTimestamp);
+    benchmark::RegisterBenchmark("BM_BatchAppend", BM_BatchAppend);
+    benchmark::RegisterBenchmark("BM_BatchBuild", BM_BatchBuild);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,737 @@
+#include "columnArchive.h"
+#include "compressedWriter.h"
+#include "metrics.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+namespace {
+
+constexpr char HEADER_MAGIC[8] = {'L', 'U', 'X', 'C', 'O', 'L', '0', '1'};
+constexpr char TRAILER_MAGIC[8] = {'L', 'U', 'X', 'C', 'E', 'N', 'D', '1'};
+constexpr size_t TRAILER_SIZE = 16;
+
+// Chunk encoding tags, stored as the first byte of every encoded chunk
+constexpr uint8_t ENCODING_DELTA_OF_DELTA = 1;
+constexpr uint8_t ENCODING_RUN_LENGTH = 2;
+constexpr uint8_t ENCODING_DELTA_BITPACK = 3;
+constexpr uint8_t ENCODING_STRING_RUN_LENGTH = 4;
+
+// ---- Byte-level helpers ----------------------------------------------------
+
+void putU8(std::vector<unsigned char>& out, uint8_t value) {
+    out.push_back(value);
+}
+
+void putU32(std::vector<unsigned char>& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+    }
+}
+
+void putU64(std::vector<unsigned char>& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+    }
+}
+
+void putVarint(std::vector<unsigned char>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Bounds-checked little-endian reader over a byte range
+class ByteReader {
+public:
+    ByteReader(const unsigned char* data, size_t size) : m_pos(data), m_end(data + size) {}
+
+    uint8_t u8() {
+        need(1);
+        return *m_pos++;
+    }
+
+    uint32_t u32() {
+        need(4);
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) {
+            value |= static_cast<uint32_t>(*m_pos++) << (8 * i);
+        }
+        return value;
+    }
+
+    uint64_t u64() {
+        need(8);
+        uint64_t value = 0;
+        for (int i = 0; i < 8; ++i) {
+            value |= static_cast<uint64_t>(*m_pos++) << (8 * i);
+        }
+        return value;
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = u8();
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Corrupt archive: varint too long");
+    }
+
+    const unsigned char* bytes(size_t size) {
+        need(size);
+        const unsigned char* start = m_pos;
+        m_pos += size;
+        return start;
+    }
+
+    const unsigned char* position() const { return m_pos; }
+    size_t remaining() const { return static_cast<size_t>(m_end - m_pos); }
+
+private:
+    void need(size_t size) const {
+        if (static_cast<size_t>(m_end - m_pos) < size) {
+            throw std::runtime_error("Corrupt archive: unexpected end of data");
+        }
+    }
+
+    const unsigned char* m_pos;
+    const unsigned char* m_end;
+};
+
+// Fixed-width values packed LSB first
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<unsigned char>& out) : m_out(out), m_bitPos(0) {}
+
+    void put(uint64_t value, int width) {
+        for (int done = 0; done < width;) {
+            if (m_bitPos == 0) {
+                m_out.push_back(0);
+            }
+            int take = std::min(8 - m_bitPos, width - done);
+            uint8_t bits = static_cast<uint8_t>((value >> done) & ((1u << take) - 1));
+            m_out.back() |= static_cast<unsigned char>(bits << m_bitPos);
+            m_bitPos = (m_bitPos + take) % 8;
+            done += take;
+        }
+    }
+
+private:
+    std::vector<unsigned char>& m_out;
+    int m_bitPos;
+};
+
+class BitReader {
+public:
+    BitReader(const unsigned char* data, size_t size) : m_data(data), m_size(size), m_bit(0) {}
+
+    uint64_t get(int width) {
+        uint64_t value = 0;
+        for (int done = 0; done < width;) {
+            size_t byte = m_bit / 8;
+            if (byte >= m_size) {
+                throw std::runtime_error("Corrupt archive: bit-packed chunk too short");
+            }
+            int offset = static_cast<int>(m_bit % 8);
+            int take = std::min(8 - offset, width - done);
+            uint64_t bits = (m_data[byte] >> offset) & ((1u << take) - 1);
+            value |= bits << done;
+            m_bit += take;
+            done += take;
+        }
+        return value;
+    }
+
+private:
+    const unsigned char* m_data;
+    size_t m_size;
+    size_t m_bit;
+};
+
+int bitWidth(uint64_t value) {
+    int width = 0;
+    while (value != 0) {
+        ++width;
+        value >>= 1;
+    }
+    return width;
+}
+
+// ---- Column encoders -------------------------------------------------------
+
+std::vector<unsigned char> encodeTimestamps(const std::vector<uint64_t>& values) {
+    std::vector<unsigned char> out;
+    putU8(out, ENCODING_DELTA_OF_DELTA);
+    int64_t previousDelta = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (i == 0) {
+            putVarint(out, values[0]);
+            continue;
+        }
+        int64_t delta = static_cast<int64_t>(values[i] - values[i - 1]);
+        putVarint(out, zigzag(delta - previousDelta));
+        previousDelta = delta;
+    }
+    return out;
+}
+
+std::vector<unsigned char> encodeRunLength(const std::vector<uint64_t>& values) {
+    std::vector<unsigned char> out;
+    putU8(out, ENCODING_RUN_LENGTH);
+    for (size_t i = 0; i < values.size();) {
+        size_t run = 1;
+        while (i + run < values.size() && values[i + run] == values[i]) {
+            ++run;
+        }
+        putVarint(out, values[i]);
+        putVarint(out, run);
+        i += run;
+    }
+    return out;
+}
+
+std::vector<unsigned char> encodeDeltaBitpack(const std::vector<uint64_t>& values) {
+    std::vector<unsigned char> out;
+    putU8(out, ENCODING_DELTA_BITPACK);
+    if (values.empty()) {
+        return out;
+    }
+
+    uint64_t widest = 0;
+    for (size_t i = 1; i < values.size(); ++i) {
+        widest |= zigzag(static_cast<int64_t>(values[i] - values[i - 1]));
+    }
+    int width = bitWidth(widest);
+
+    putVarint(out, values[0]);
+    putU8(out, static_cast<uint8_t>(width));
+    BitWriter bits(out);
+    for (size_t i = 1; i < values.size(); ++i) {
+        bits.put(zigzag(static_cast<int64_t>(values[i] - values[i - 1])), width);
+    }
+    return out;
+}
+
+// Slowly varying and constant columns compress best with different schemes; keep the smaller
+std::vector<unsigned char> encodeIntegers(const std::vector<uint64_t>& values) {
+    std::vector<unsigned char> runLength = encodeRunLength(values);
+    std::vector<unsigned char> bitpacked = encodeDeltaBitpack(values);
+    return runLength.size() <= bitpacked.size() ? runLength : bitpacked;
+}
+
+std::vector<unsigned char> encodeStrings(const Snapshot* rows, size_t count, TelemetryString Snapshot::*member) {
+    std::vector<unsigned char> out;
+    putU8(out, ENCODING_STRING_RUN_LENGTH);
+    for (size_t i = 0; i < count;) {
+        const TelemetryString& value = rows[i].*member;
+        size_t run = 1;
+        while (i + run < count && (rows[i + run].*member).length == value.length &&
+               std::memcmp((rows[i + run].*member).data, value.data, value.length) == 0) {
+            ++run;
+        }
+        putVarint(out, value.length);
+        out.insert(out.end(), value.data, value.data + value.length);
+        putVarint(out, run);
+        i += run;
+    }
+    return out;
+}
+
+std::vector<unsigned char> encodeColumn(const Snapshot* rows, size_t count, uint32_t Snapshot::*member) {
+    std::vector<uint64_t> values(count);
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = rows[i].*member;
+    }
+    return encodeIntegers(values);
+}
+
+std::vector<unsigned char> encodeColumn(const Snapshot* rows, size_t count, TelemetryString Snapshot::*member) {
+    return encodeStrings(rows, count, member);
+}
+
+constexpr ColumnType columnTypeOf(uint32_t Snapshot::*) { return ColumnType::Uint32; }
+constexpr ColumnType columnTypeOf(TelemetryString Snapshot::*) { return ColumnType::String; }
+
+// ---- Column decoders -------------------------------------------------------
+
+void decodeNumbers(ByteReader& reader, ColumnType type, uint32_t rows, std::vector<uint64_t>& out) {
+    out.resize(rows);
+    if (rows == 0) {
+        return;
+    }
+
+    uint8_t encoding = reader.u8();
+    if (type == ColumnType::Timestamp && encoding == ENCODING_DELTA_OF_DELTA) {
+        out[0] = reader.varint();
+        int64_t delta = 0;
+        for (uint32_t i = 1; i < rows; ++i) {
+            delta += unzigzag(reader.varint());
+            out[i] = out[i - 1] + static_cast<uint64_t>(delta);
+        }
+    } else if (encoding == ENCODING_RUN_LENGTH) {
+        uint32_t filled = 0;
+        while (filled < rows) {
+            uint64_t value = reader.varint();
+            uint64_t run = reader.varint();
+            if (run == 0 || run > rows - filled) {
+                throw std::runtime_error("Corrupt archive: bad run length");
+            }
+            std::fill(out.begin() + filled, out.begin() + filled + run, value);
+            filled += static_cast<uint32_t>(run);
+        }
+    } else if (encoding == ENCODING_DELTA_BITPACK) {
+        out[0] = reader.varint();
+        int width = reader.u8();
+        if (width > 64) {
+            throw std::runtime_error("Corrupt archive: bad bit width");
+        }
+        BitReader bits(reader.position(), reader.remaining());
+        for (uint32_t i = 1; i < rows; ++i) {
+            out[i] = out[i - 1] + static_cast<uint64_t>(unzigzag(bits.get(width)));
+        }
+    } else {
+        throw std::runtime_error("Corrupt archive: unknown integer encoding");
+    }
+}
+
+void decodeStrings(ByteReader& reader, uint32_t rows, std::vector<std::string>& out) {
+    out.clear();
+    out.reserve(rows);
+    if (rows == 0) {
+        return;
+    }
+    if (reader.u8() != ENCODING_STRING_RUN_LENGTH) {
+        throw std::runtime_error("Corrupt archive: unknown string encoding");
+    }
+    while (out.size() < rows) {
+        uint64_t length = reader.varint();
+        const unsigned char* data = reader.bytes(length);
+        uint64_t run = reader.varint();
+        if (run == 0 || run > rows - out.size()) {
+            throw std::runtime_error("Corrupt archive: bad run length");
+        }
+        out.insert(out.end(), run, std::string(reinterpret_cast<const char*>(data), length));
+    }
+}
+
+void readColumn(const char* value, unsigned long length, uint32_t& out) {
+    (void)length;
+    out = value ? static_cast<uint32_t>(std::strtoul(value, nullptr, 10)) : 0;
+}
+
+void readColumn(const char* value, unsigned long length, TelemetryString& out) {
+    out.assign(value ? value : "", value ? length : 0);
+}
+
+void preadAll(int fd, unsigned char* buffer, size_t size, uint64_t offset, const std::string& path) {
+    while (size > 0) {
+        ssize_t got = ::pread(fd, buffer, size, static_cast<off_t>(offset));
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            throw std::runtime_error("Failed to read archive: " + path);
+        }
+        buffer += got;
+        size -= static_cast<size_t>(got);
+        offset += static_cast<uint64_t>(got);
+    }
+}
+
+} // namespace
+
+// ---- Format ----------------------------------------------------------------
+
+std::vector<ColumnInfo> snapshotColumns() {
+    std::vector<ColumnInfo> columns;
+#define SNAPSHOT_COLUMN(command, name, type) columns.push_back({#name, columnTypeOf(&Snapshot::name)});
+    TELEMETRY_FIELDS(SNAPSHOT_COLUMN)
+#undef SNAPSHOT_COLUMN
+    columns.push_back({"timestamp", ColumnType::Timestamp});
+    return columns;
+}
+
+std::vector<unsigned char> encodeArchiveHeader(const std::vector<ColumnInfo>& columns) {
+    std::vector<unsigned char> out(HEADER_MAGIC, HEADER_MAGIC + sizeof(HEADER_MAGIC));
+    putU32(out, static_cast<uint32_t>(columns.size()));
+    for (const auto& column : columns) {
+        putU8(out, static_cast<uint8_t>(column.type));
+        putU8(out, static_cast<uint8_t>(column.name.size()));
+        out.insert(out.end(), column.name.begin(), column.name.end());
+    }
+    return out;
+}
+
+std::vector<unsigned char> encodeArchiveBlock(const Snapshot* rows, size_t count, BlockIndex& index) {
+    std::vector<unsigned char> block;
+    index.rows = static_cast<uint32_t>(count);
+    index.minTimestamp = UINT64_MAX;
+    index.maxTimestamp = 0;
+    index.chunks.clear();
+
+    auto addChunk = [&block, &index](const std::vector<unsigned char>& encoded) {
+        uLongf storedSize = compressBound(encoded.size());
+        size_t offset = block.size();
+        block.resize(offset + storedSize);
+        if (compress2(block.data() + offset, &storedSize, encoded.data(), encoded.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+            throw std::runtime_error("Failed to compress archive column");
+        }
+        block.resize(offset + storedSize);
+        index.chunks.push_back({offset, static_cast<uint32_t>(storedSize), static_cast<uint32_t>(encoded.size())});
+    };
+
+#define ENCODE_COLUMN(command, name, type) addChunk(encodeColumn(rows, count, &Snapshot::name));
+    TELEMETRY_FIELDS(ENCODE_COLUMN)
+#undef ENCODE_COLUMN
+
+    std::vector<uint64_t> timestamps(count);
+    for (size_t i = 0; i < count; ++i) {
+        timestamps[i] = rows[i].timestampMs;
+        index.minTimestamp = std::min(index.minTimestamp, timestamps[i]);
+        index.maxTimestamp = std::max(index.maxTimestamp, timestamps[i]);
+    }
+    addChunk(encodeTimestamps(timestamps));
+    return block;
+}
+
+std::vector<unsigned char> encodeArchiveFooter(const std::vector<BlockIndex>& blocks, uint64_t footerOffset) {
+    std::vector<unsigned char> out;
+    putU32(out, static_cast<uint32_t>(blocks.size()));
+    for (const auto& block : blocks) {
+        putU32(out, block.rows);
+        putU64(out, block.minTimestamp);
+        putU64(out, block.maxTimestamp);
+        for (const auto& chunk : block.chunks) {
+            putU64(out, chunk.offset);
+            putU32(out, chunk.storedSize);
+            putU32(out, chunk.encodedSize);
+        }
+    }
+    putU64(out, footerOffset);
+    out.insert(out.end(), TRAILER_MAGIC, TRAILER_MAGIC + sizeof(TRAILER_MAGIC));
+    return out;
+}
+
+std::string columnarSelectList() {
+    std::string columns;
+    for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; ++i) {
+        columns += TELEMETRY_COLUMNS[i];
+        columns += ", ";
+    }
+    return columns + "CAST(UNIX_TIMESTAMP(timestamp) * 1000 AS UNSIGNED)";
+}
+
+void snapshotFromRow(MYSQL_ROW row, const unsigned long* lengths, Snapshot& snapshot) {
+    size_t column = 0;
+#define FROM_ROW(command, name, type) readColumn(row[column], lengths[column], snapshot.name); ++column;
+    TELEMETRY_FIELDS(FROM_ROW)
+#undef FROM_ROW
+    snapshot.timestampMs = row[column] ? std::strtoull(row[column], nullptr, 10) : 0;
+}
+
+// ---- Writer ----------------------------------------------------------------
+
+ColumnArchiveWriter::ColumnArchiveWriter(const std::string& path)
+    : m_path(path)
+    , m_tempPath(path + ".part")
+    , m_fd(-1)
+    , m_offset(0) {
+    m_fd = ::open(m_tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd == -1) {
+        throw std::runtime_error("Failed to open file for writing: " + m_tempPath);
+    }
+    m_rows.reserve(COLUMN_BLOCK_ROWS);
+    writeBytes(encodeArchiveHeader(snapshotColumns()));
+}
+
+ColumnArchiveWriter::~ColumnArchiveWriter() {
+    if (m_fd != -1) {
+        // Abandoned without close(); the archive is incomplete
+        ::close(m_fd);
+        std::remove(m_tempPath.c_str());
+    }
+}
+
+void ColumnArchiveWriter::append(const Snapshot& row) {
+    m_rows.push_back(row);
+    if (m_rows.size() >= COLUMN_BLOCK_ROWS) {
+        flushBlock();
+    }
+}
+
+void ColumnArchiveWriter::flushBlock() {
+    if (m_rows.empty()) {
+        return;
+    }
+    BlockIndex index;
+    std::vector<unsigned char> block;
+    {
+        StageTimer timer(pipelineMetrics().compressBlock);
+        block = encodeArchiveBlock(m_rows.data(), m_rows.size(), index);
+    }
+    for (auto& chunk : index.chunks) {
+        chunk.offset += m_offset;
+    }
+    writeBytes(block);
+    m_blocks.push_back(std::move(index));
+    m_rows.clear();
+}
+
+void ColumnArchiveWriter::writeBytes(const std::vector<unsigned char>& bytes) {
+    const unsigned char* data = bytes.data();
+    size_t size = bytes.size();
+    while (size > 0) {
+        ssize_t written = ::write(m_fd, data, size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Failed to write to: " + m_tempPath);
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    m_offset += bytes.size();
+    pipelineMetrics().archivedBytes.add(bytes.size());
+}
+
+void ColumnArchiveWriter::close() {
+    if (m_fd == -1) {
+        return;
+    }
+    flushBlock();
+    writeBytes(encodeArchiveFooter(m_blocks, m_offset));
+
+    int fd = m_fd;
+    m_fd = -1;
+    bool synced = ::fsync(fd) == 0;
+    bool closed = ::close(fd) == 0;
+    if (!synced || !closed || std::rename(m_tempPath.c_str(), m_path.c_str()) != 0) {
+        std::remove(m_tempPath.c_str());
+        throw std::runtime_error("Failed to finish archive: " + m_path);
+    }
+    syncDirectory(m_path);
+}
+
+// ---- Reader ----------------------------------------------------------------
+
+ColumnArchiveReader::ColumnArchiveReader(const std::string& path)
+    : m_path(path)
+    , m_fd(-1)
+    , m_timestampColumn(0) {
+    m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd == -1) {
+        throw std::runtime_error("Failed to open archive: " + path);
+    }
+
+    try {
+        struct stat info;
+        if (::fstat(m_fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(HEADER_MAGIC) + 4 + TRAILER_SIZE) {
+            throw std::runtime_error("Not a column archive: " + path);
+        }
+        uint64_t fileSize = static_cast<uint64_t>(info.st_size);
+
+        unsigned char trailer[TRAILER_SIZE];
+        preadAll(m_fd, trailer, sizeof(trailer), fileSize - TRAILER_SIZE, path);
+        if (std::memcmp(trailer + 8, TRAILER_MAGIC, sizeof(TRAILER_MAGIC)) != 0) {
+            throw std::runtime_error("Not a complete column archive: " + path);
+        }
+        uint64_t footerOffset = ByteReader(trailer, 8).u64();
+        if (footerOffset > fileSize - TRAILER_SIZE) {
+            throw std::runtime_error("Corrupt archive footer: " + path);
+        }
+
+        // The header ends before the first block, which can be no later than the footer
+        std::vector<unsigned char> header(std::min<uint64_t>(footerOffset, 64 * 1024));
+        preadAll(m_fd, header.data(), header.size(), 0, path);
+        ByteReader headerReader(header.data(), header.size());
+        if (std::memcmp(headerReader.bytes(sizeof(HEADER_MAGIC)), HEADER_MAGIC, sizeof(HEADER_MAGIC)) != 0) {
+            throw std::runtime_error("Not a column archive: " + path);
+        }
+        uint32_t columnCount = headerReader.u32();
+        bool haveTimestamp = false;
+        for (uint32_t i = 0; i < columnCount; ++i) {
+            ColumnInfo column;
+            column.type = static_cast<ColumnType>(headerReader.u8());
+            uint8_t nameLength = headerReader.u8();
+            column.name.assign(reinterpret_cast<const char*>(headerReader.bytes(nameLength)), nameLength);
+            if (column.type == ColumnType::Timestamp) {
+                m_timestampColumn = i;
+                haveTimestamp = true;
+            }
+            m_columns.push_back(std::move(column));
+        }
+        if (!haveTimestamp) {
+            throw std::runtime_error("Archive has no timestamp column: " + path);
+        }
+
+        std::vector<unsigned char> footer(fileSize - TRAILER_SIZE - footerOffset);
+        preadAll(m_fd, footer.data(), footer.size(), footerOffset, path);
+        ByteReader footerReader(footer.data(), footer.size());
+        uint32_t blockCount = footerReader.u32();
+        for (uint32_t b = 0; b < blockCount; ++b) {
+            BlockIndex block;
+            block.rows = footerReader.u32();
+            block.minTimestamp = footerReader.u64();
+            block.maxTimestamp = footerReader.u64();
+            for (uint32_t c = 0; c < columnCount; ++c) {
+                ChunkRef chunk;
+                chunk.offset = footerReader.u64();
+                chunk.storedSize = footerReader.u32();
+                chunk.encodedSize = footerReader.u32();
+                block.chunks.push_back(chunk);
+            }
+            m_blocks.push_back(std::move(block));
+        }
+    } catch (...) {
+        ::close(m_fd);
+        throw;
+    }
+}
+
+ColumnArchiveReader::~ColumnArchiveReader() {
+    if (m_fd != -1) {
+        ::close(m_fd);
+    }
+}
+
+uint64_t ColumnArchiveReader::rowCount() const {
+    uint64_t rows = 0;
+    for (const auto& block : m_blocks) {
+        rows += block.rows;
+    }
+    return rows;
+}
+
+std::vector<unsigned char> ColumnArchiveReader::readChunk(const ChunkRef& chunk) const {
+    std::vector<unsigned char> stored(chunk.storedSize);
+    preadAll(m_fd, stored.data(), stored.size(), chunk.offset, m_path);
+
+    std::vector<unsigned char> encoded(chunk.encodedSize);
+    uLongf encodedSize = chunk.encodedSize;
+    if (uncompress(encoded.data(), &encodedSize, stored.data(), stored.size()) != Z_OK ||
+        encodedSize != chunk.encodedSize) {
+        throw std::runtime_error("Corrupt archive chunk: " + m_path);
+    }
+    return encoded;
+}
+
+void ColumnArchiveReader::decodeColumn(const ChunkRef& chunk, ColumnType type, uint32_t rows, ColumnValues& out) const {
+    std::vector<unsigned char> encoded = readChunk(chunk);
+    ByteReader reader(encoded.data(), encoded.size());
+    out.type = type;
+    if (type == ColumnType::String) {
+        decodeStrings(reader, rows, out.strings);
+    } else {
+        decodeNumbers(reader, type, rows, out.numbers);
+    }
+}
+
+// Indexes of the named columns, or of every column when none are named
+std::vector<size_t> ColumnArchiveReader::selectColumns(const std::vector<std::string>& columnNames) const {
+    std::vector<size_t> selected;
+    if (columnNames.empty()) {
+        for (size_t i = 0; i < m_columns.size(); ++i) {
+            selected.push_back(i);
+        }
+    } else {
+        for (const auto& name : columnNames) {
+            auto it = std::find_if(m_columns.begin(), m_columns.end(),
+                                   [&name](const ColumnInfo& column) { return column.name == name; });
+            if (it == m_columns.end()) {
+                throw std::runtime_error("Unknown column: " + name);
+            }
+            selected.push_back(static_cast<size_t>(it - m_columns.begin()));
+        }
+    }
+    return selected;
+}
+
+void ColumnArchiveReader::readBlock(size_t block, const std::vector<std::string>& columnNames,
+                                    ColumnBatch& batch) const {
+    std::vector<size_t> selected = selectColumns(columnNames);
+    const BlockIndex& index = m_blocks.at(block);
+    batch.rows = index.rows;
+    batch.columns.resize(selected.size());
+    for (size_t c = 0; c < selected.size(); ++c) {
+        decodeColumn(index.chunks[selected[c]], m_columns[selected[c]].type, index.rows, batch.columns[c]);
+    }
+}
+
+void ColumnArchiveReader::scan(uint64_t fromMs, uint64_t toMs, const std::vector<std::string>& columnNames,
+                               const std::function<void(const ColumnBatch&)>& onBatch) const {
+    std::vector<size_t> selected = selectColumns(columnNames);
+
+    ColumnValues timestamps;
+    ColumnValues decoded;
+    std::vector<uint8_t> keep;
+    for (const auto& block : m_blocks) {
+        if (block.rows == 0 || block.maxTimestamp < fromMs || block.minTimestamp > toMs) {
+            continue;
+        }
+
+        // Rows are not necessarily in time order, so filter row by row unless the whole block matches
+        bool wholeBlock = block.minTimestamp >= fromMs && block.maxTimestamp <= toMs;
+        size_t matching = block.rows;
+        if (!wholeBlock) {
+            decodeColumn(block.chunks[m_timestampColumn], ColumnType::Timestamp, block.rows, timestamps);
+            keep.assign(block.rows, 0);
+            matching = 0;
+            for (uint32_t i = 0; i < block.rows; ++i) {
+                if (timestamps.numbers[i] >= fromMs && timestamps.numbers[i] <= toMs) {
+                    keep[i] = 1;
+                    ++matching;
+                }
+            }
+            if (matching == 0) {
+                continue;
+            }
+        }
+
+        ColumnBatch batch;
+        batch.rows = matching;
+        batch.columns.resize(selected.size());
+        for (size_t c = 0; c < selected.size(); ++c) {
+            size_t column = selected[c];
+            ColumnValues& values = batch.columns[c];
+            decodeColumn(block.chunks[column], m_columns[column].type, block.rows, wholeBlock ? values : decoded);
+            if (wholeBlock) {
+                continue;
+            }
+
+            values.type = decoded.type;
+            for (uint32_t i = 0; i < block.rows; ++i) {
+                if (!keep[i]) {
+                    continue;
+                }
+                if (decoded.type == ColumnType::String) {
+                    values.strings.push_back(std::move(decoded.strings[i]));
+                } else {
+                    values.numbers.push_back(decoded.numbers[i]);
+                }
+            }
+        }
+        onBatch(batch);
+    }
+}
@@ -0,0 +1,139 @@
+#ifndef COLUMN_ARCHIVE_H
+#define COLUMN_ARCHIVE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+#include <mariadb/mysql.h>
+#include "snapshot.h"
+
+// Columnar archive format for retired partitions (".lxc").
+//
+//   header   "LUXCOL01", u32 column count, per column: u8 type, u8 name length, name
+//   blocks   row groups of up to COLUMN_BLOCK_ROWS rows; each column is one
+//            encoded chunk, deflated
+//   footer   u32 block count, per block: u32 rows, u64 min/max timestamp, per
+//            column: u64 offset, u32 stored size, u32 encoded size
+//   trailer  u64 footer offset, "LUXCEND1"
+//
+// Chunk encodings: delta-of-delta varints for the timestamp, run-length or
+// bit-packed deltas (whichever is smaller) for integer columns, run-length
+// for strings. All integers are little-endian. The footer lets a reader skip
+// blocks outside a time range and decode only the columns it asks for.
+
+constexpr size_t COLUMN_BLOCK_ROWS = 8192;
+constexpr const char* COLUMN_ARCHIVE_EXTENSION = ".lxc";
+
+// Format written when a partition is retired
+enum class ArchiveFormat {
+    CsvGzip,    ///< <partition>.csv.gz
+    Columnar,   ///< <partition>.lxc
+};
+
+enum class ColumnType : uint8_t {
+    Timestamp = 0,      ///< Epoch milliseconds
+    Uint32 = 1,
+    String = 2,
+};
+
+struct ColumnInfo {
+    std::string name;
+    ColumnType type;
+};
+
+struct ChunkRef {
+    uint64_t offset;
+    uint32_t storedSize;
+    uint32_t encodedSize;
+};
+
+struct BlockIndex {
+    uint32_t rows;
+    uint64_t minTimestamp;
+    uint64_t maxTimestamp;
+    std::vector<ChunkRef> chunks;   ///< One per column, in header order
+};
+
+// Columns of the current telemetry schema, timestamp last
+std::vector<ColumnInfo> snapshotColumns();
+
+// Building blocks shared by the sequential writer and the archive pipeline
+std::vector<unsigned char> encodeArchiveHeader(const std::vector<ColumnInfo>& columns);
+// Chunk offsets in the returned index are relative to the start of the block
+std::vector<unsigned char> encodeArchiveBlock(const Snapshot* rows, size_t count, BlockIndex& index);
+std::vector<unsigned char> encodeArchiveFooter(const std::vector<BlockIndex>& blocks, uint64_t footerOffset);
+
+// SELECT list matching snapshotFromRow(): schema fields, then the timestamp in epoch ms
+std::string columnarSelectList();
+void snapshotFromRow(MYSQL_ROW row, const unsigned long* lengths, Snapshot& snapshot);
+
+// Writes a columnar archive to path + ".part" and renames it once close() has fsync'd it
+class ColumnArchiveWriter {
+public:
+    explicit ColumnArchiveWriter(const std::string& path);
+    ~ColumnArchiveWriter();
+
+    ColumnArchiveWriter(const ColumnArchiveWriter&) = delete;
+    ColumnArchiveWriter& operator=(const ColumnArchiveWriter&) = delete;
+
+    void append(const Snapshot& row);
+    void close();
+
+private:
+    void flushBlock();
+    void writeBytes(const std::vector<unsigned char>& bytes);
+
+    std::string m_path;
+    std::string m_tempPath;
+    int m_fd;
+    uint64_t m_offset;
+    std::vector<Snapshot> m_rows;
+    std::vector<BlockIndex> m_blocks;
+};
+
+// Decoded values of one column for the rows of a block that matched a scan
+struct ColumnValues {
+    ColumnType type;
+    std::vector<uint64_t> numbers;      ///< Timestamp and Uint32 columns
+    std::vector<std::string> strings;   ///< String columns
+};
+
+struct ColumnBatch {
+    size_t rows;
+    std::vector<ColumnValues> columns;  ///< In the order requested from scan()
+};
+
+class ColumnArchiveReader {
+public:
+    explicit ColumnArchiveReader(const std::string& path);
+    ~ColumnArchiveReader();
+
+    ColumnArchiveReader(const ColumnArchiveReader&) = delete;
+    ColumnArchiveReader& operator=(const ColumnArchiveReader&) = delete;
+
+    const std::vector<ColumnInfo>& columns() const { return m_columns; }
+    const std::vector<BlockIndex>& blocks() const { return m_blocks; }
+    uint64_t rowCount() const;
+
+    // Visit rows with fromMs <= timestamp <= toMs, decoding only the named
+    // columns (all columns when empty). Blocks outside the range are skipped
+    // without being read.
+    void scan(uint64_t fromMs, uint64_t toMs, const std::vector<std::string>& columnNames,
+              const std::function<void(const ColumnBatch&)>& onBatch) const;
+    // Decode the named columns (all columns when empty) of every row of one block
+    void readBlock(size_t block, const std::vector<std::string>& columnNames, ColumnBatch& batch) const;
+
+private:
+    std::vector<size_t> selectColumns(const std::vector<std::string>& columnNames) const;
+    std::vector<unsigned char> readChunk(const ChunkRef& chunk) const;
+    void decodeColumn(const ChunkRef& chunk, ColumnType type, uint32_t rows, ColumnValues& out) const;
+
+    std::string m_path;
+    int m_fd;
+    std::vector<ColumnInfo> m_columns;
+    std::vector<BlockIndex> m_blocks;
+    size_t m_timestampColumn;
+};
+
+#endif // COLUMN_ARCHIVE_H
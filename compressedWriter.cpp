@@ -0,0 +1,142 @@
+#include "compressedWriter.h"
+#include "metrics.h"
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+CompressedWriter::CompressedWriter(const std::string& path, size_t bufferSize)
+    : m_path(path)
+    , m_fd(-1)
+    , m_output(bufferSize) {
+    m_input.reserve(bufferSize);
+
+    std::memset(&m_stream, 0, sizeof(m_stream));
+    // windowBits 15 + 16 selects the gzip container
+    if (deflateInit2(&m_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Failed to initialise compression for: " + path);
+    }
+
+    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd == -1) {
+        deflateEnd(&m_stream);
+        throw std::runtime_error("Failed to open file for writing: " + path);
+    }
+}
+
+CompressedWriter::~CompressedWriter() {
+    if (m_fd != -1) {
+        // Abandoned without close(); the file is incomplete
+        deflateEnd(&m_stream);
+        ::close(m_fd);
+    }
+}
+
+void CompressedWriter::write(const char* data, size_t size) {
+    while (size > 0) {
+        size_t space = m_input.capacity() - m_input.size();
+        if (space == 0) {
+            deflateInput(Z_NO_FLUSH);
+            continue;
+        }
+        size_t chunk = size < space ? size : space;
+        m_input.insert(m_input.end(), data, data + chunk);
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+// Compress everything in the input buffer and write the result out
+void CompressedWriter::deflateInput(int flush) {
+    StageTimer timer(pipelineMetrics().compressBlock);
+    m_stream.next_in = reinterpret_cast<Bytef*>(m_input.data());
+    m_stream.avail_in = static_cast<uInt>(m_input.size());
+
+    int status;
+    do {
+        m_stream.next_out = m_output.data();
+        m_stream.avail_out = static_cast<uInt>(m_output.size());
+        status = deflate(&m_stream, flush);
+        if (status == Z_STREAM_ERROR) {
+            throw std::runtime_error("Compression failed for: " + m_path);
+        }
+        writeOutput(m_output.data(), m_output.size() - m_stream.avail_out);
+    } while (m_stream.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+
+    m_input.clear();
+}
+
+void CompressedWriter::writeOutput(const unsigned char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(m_fd, data, size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Failed to write to: " + m_path);
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+        pipelineMetrics().archivedBytes.add(static_cast<size_t>(written));
+    }
+}
+
+void CompressedWriter::close() {
+    if (m_fd == -1) {
+        return;
+    }
+    deflateInput(Z_FINISH);
+    deflateEnd(&m_stream);
+
+    int fd = m_fd;
+    m_fd = -1;
+    if (::fsync(fd) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Failed to sync: " + m_path);
+    }
+    if (::close(fd) != 0) {
+        throw std::runtime_error("Failed to close: " + m_path);
+    }
+    syncDirectory(m_path);
+}
+
+void gzipCompress(const char* data, size_t size, std::vector<unsigned char>& out) {
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Failed to initialise compression");
+    }
+
+    // deflateBound covers the worst case, so one Z_FINISH call completes the member
+    out.resize(deflateBound(&stream, size) + 32);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(size);
+    stream.next_out = out.data();
+    stream.avail_out = static_cast<uInt>(out.size());
+
+    int status = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (status != Z_STREAM_END) {
+        throw std::runtime_error("Compression failed");
+    }
+    out.resize(out.size() - stream.avail_out);
+}
+
+void syncDirectory(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+    if (directory.empty()) {
+        directory = "/";
+    }
+
+    int dirFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd == -1) {
+        throw std::runtime_error("Failed to open directory: " + directory);
+    }
+    int status = ::fsync(dirFd);
+    ::close(dirFd);
+    if (status != 0) {
+        throw std::runtime_error("Failed to sync directory: " + directory);
+    }
+}
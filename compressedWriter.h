@@ -0,0 +1,50 @@
+#ifndef COMPRESSED_WRITER_H
+#define COMPRESSED_WRITER_H
+
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+// Buffered gzip file writer. Data is collected in a large input buffer and
+// deflated in place as it fills, so the file is compressed in a single pass
+// with constant memory regardless of how much is written.
+class CompressedWriter {
+public:
+    explicit CompressedWriter(const std::string& path, size_t bufferSize = 256 * 1024);
+    ~CompressedWriter();
+
+    CompressedWriter(const CompressedWriter&) = delete;
+    CompressedWriter& operator=(const CompressedWriter&) = delete;
+
+    void write(const char* data, size_t size);
+    void write(char c) {
+        if (m_input.size() == m_input.capacity()) {
+            deflateInput(Z_NO_FLUSH);
+        }
+        m_input.push_back(c);
+    }
+
+    // Finish the gzip stream, fsync and close the file; throws on failure
+    void close();
+
+    const std::string& path() const { return m_path; }
+
+private:
+    void deflateInput(int flush);
+    void writeOutput(const unsigned char* data, size_t size);
+
+    std::string m_path;
+    int m_fd;
+    z_stream m_stream;
+    std::vector<char> m_input;
+    std::vector<unsigned char> m_output;
+};
+
+// Compress a buffer into one complete gzip member. Concatenated members form
+// a valid gzip file, so blocks can be compressed independently and appended.
+void gzipCompress(const char* data, size_t size, std::vector<unsigned char>& out);
+
+// fsync the directory containing path, making a create or rename durable
+void syncDirectory(const std::string& path);
+
+#endif // COMPRESSED_WRITER_H
@@ -1,176 +1,71 @@
-#include <iostream>
 #include <unordered_map>
 #include <msgpack.hpp>
 #include <mariadb/mysql.h>
 #include "dataStorage.h"
-#include <iomanip>  // For std::put_time
-#include <sstream>  // For std::stringstream
-
-// Constructor to initialize the MariaDB connection
-DataStorage::DataStorage() {
-    conn = mysql_init(NULL);
-    if (conn == NULL) {
-        std::cerr << "mysql_init() failed" << std::endl;
-        return;
-    }
-
-    // Connect to the database (replace with your credentials)
-    if (mysql_real_connect(conn, "localhost", "my_user", "my_password", "my_database", 0, NULL, 0) == NULL) {
-        std::cerr << "mysql_real_connect() failed: " << mysql_error(conn) << std::endl;
-        mysql_close(conn);
-        return;
-    }
+#include "logger.h"
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "msgpackFields.h"
+#include "telemetryDecoder.h"
+#include "metrics.h"
+
+namespace {
+// Days of partitions kept created ahead of the current day
+constexpr int PARTITION_DAYS_AHEAD = 7;
+// Rows the spools can hold together (about 136 bytes each) before new rows are dropped
+constexpr size_t SPOOL_CAPACITY_ROWS = 1024 * 1024;
+// How often the deadband filter's savings are logged
+constexpr auto DEADBAND_REPORT_INTERVAL = std::chrono::minutes(10);
+// Rows held per endpoint while its device's serialNumber is still unknown
+constexpr size_t MAX_HELD_ROWS = 4096;
+
+bool isProvisional(DataStorage::DeviceKey key) {
+    return key > UINT32_MAX;
 }
-
-// Destructor to close the MariaDB connection
-DataStorage::~DataStorage() {
-    if (conn != NULL) {
-        mysql_close(conn);
-    }
 }
 
-void DataStorage::handleTimestamp(const std::unordered_map<std::string, msgpack::object>& dataMap) {
-    try {
-        // Verify timestamp exists and is of correct type
-        if (dataMap.count("timestamp") == 0) {
-            throw std::runtime_error("Timestamp key not found");
-        }
-
-        // Attempt to extract timestamp
-        uint64_t receivedTimestamp = dataMap.at("timestamp").as<uint64_t>();
-
-        // Validate timestamp (optional, but can catch some edge cases)
-        if (receivedTimestamp == 0) {
-            throw std::runtime_error("Zero timestamp received");
-        }
-
-        time_t seconds = receivedTimestamp / 1000;                           // Extract seconds
-        uint64_t milliseconds = receivedTimestamp % 1000;                    // Extract milliseconds
-
-        // Convert seconds to time structure
-        std::tm* tmTime = std::localtime(&seconds);  // Using localtime instead of gmtime
-        if (!tmTime) {
-            throw std::runtime_error("Failed to parse timestamp");
-        }
-
-        // Format timestamp as `YYYY-MM-DD HH:MM:SS.mmm`
-        std::stringstream timestampStream;
-        timestampStream << std::put_time(tmTime, "%Y-%m-%d %H:%M:%S") << '.' 
-                        << std::setw(3) << std::setfill('0') << milliseconds;
-
-        // Store the formatted timestamp
-        timestamp.formatted = timestampStream.str();
-    } 
-    catch (const std::exception& e) {
-        std::cerr << "Timestamp handling error: " << e.what() << std::endl;
-        throw;  // Re-throw to prevent silently continuing
+// Constructor to start partition maintenance, the rollups and the writer threads
+DataStorage::DataStorage(const FlushPolicy& flushPolicy, size_t queueCapacity, const DbConfig& dbConfig,
+                         const std::string& spoolPath, size_t writerCount)
+    : dbConfig(dbConfig)
+    , policy(flushPolicy)
+    , partitionHorizon(0) {
+    // Partitions are maintained on their own connection and thread
+    partitionMaintainer = std::make_unique<PartitionMaintainer>(dbConfig, tableName, PARTITION_DAYS_AHEAD,
+        [this](std::time_t horizon) { partitionHorizon = horizon; });
+    rollupEngine = std::make_unique<RollupEngine>(dbConfig, tableName, PARTITION_DAYS_AHEAD);
+
+    // The first writer keeps the configured spool file; the others add their index
+    writerCount = std::max<size_t>(writerCount, 1);
+    for (size_t i = 0; i < writerCount; ++i) {
+        std::string path = i == 0 ? spoolPath : spoolPath + "." + std::to_string(i);
+        writers.push_back(std::make_unique<StorageWriter>(dbConfig, tableName, policy, queueCapacity, path,
+                                                          SPOOL_CAPACITY_ROWS / writerCount,
+                                                          *partitionMaintainer, partitionHorizon));
     }
 }
 
-void createMonthlyPartitions(MYSQL* conn) {
-    // Get current time
-    std::time_t now = std::time(nullptr);
-    std::tm* currentTime = std::localtime(&now);
-    
-    // Determine days in current month
-    int daysInMonth = [](int year, int month) {
-        static const int days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-        return (month == 1 && (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))) ? 29 : days[month];
-    }(currentTime->tm_year + 1900, currentTime->tm_mon);
-
-    // Existing partitions tracking
-    std::map<std::string, long long> existingPartitions;
-    std::string checkQuery = 
-        "SELECT partition_name, CAST(partition_description AS SIGNED) as part_desc FROM information_schema.partitions "
-        "WHERE table_schema = DATABASE() AND table_name = 'laser_data' "
-        "ORDER BY part_desc";
-
-    if (mysql_query(conn, checkQuery.c_str())) {
-        std::cerr << "Failed to check partitions: " << mysql_error(conn) << std::endl;
-        return;
-    }
-
-    MYSQL_RES* result = mysql_store_result(conn);
-    if (!result) {
-        std::cerr << "Failed to retrieve partitions: " << mysql_error(conn) << std::endl;
-        return;
-    }
-
-    long long lastPartitionValue = 0;
-    MYSQL_ROW row;
-    while ((row = mysql_fetch_row(result))) {
-        std::string partitionName(row[0]);
-        long long partitionValue = row[1] ? std::stoll(row[1]) : 0;
-        existingPartitions[partitionName] = partitionValue;
-        lastPartitionValue = std::max(lastPartitionValue, partitionValue);
-    }
-    mysql_free_result(result);
-
-    // Prepare partition creation query
-    std::stringstream partitionQuery;
-    partitionQuery << "ALTER TABLE laser_data ADD PARTITION (";
-
-    bool firstPartition = true;
-    bool partitionNeedsAdding = false;
-
-    // Create partitions for remaining days
-    for (int day = currentTime->tm_mday; day <= daysInMonth; ++day) {
-        // Construct partition time
-        std::tm partitionTime = *currentTime;
-        partitionTime.tm_mday = day;
-        partitionTime.tm_hour = 0;
-        partitionTime.tm_min = 0;
-        partitionTime.tm_sec = 0;
-        std::mktime(&partitionTime);
-
-        // Generate partition name (PYYYYMMDD)
-        char partitionName[20];
-        std::snprintf(partitionName, sizeof(partitionName), 
-            "P%d%02d%02d", 
-            partitionTime.tm_year + 1900, 
-            partitionTime.tm_mon + 1, 
-            partitionTime.tm_mday);
-
-        // Skip existing partitions
-        if (existingPartitions.count(partitionName) > 0) {
-            std::cout << "Partition " << partitionName << " already exists. Skipping." << std::endl;
-            continue;
-        }
-
-        // Format date for VALUES LESS THAN ('YYYY-MM-DD 00:00:00')
-        char dateBuffer[80];
-        std::strftime(dateBuffer, sizeof(dateBuffer), "%Y-%m-%d 00:00:00", &partitionTime);
-
-        // Add to partition query in the correct format
-        if (!firstPartition) {
-            partitionQuery << ", ";
-        }
-        partitionQuery << "PARTITION " << partitionName 
-                       << " VALUES LESS THAN ('" << dateBuffer << "')";
-
-        firstPartition = false;
-        partitionNeedsAdding = true;
-    }
-
-    partitionQuery << ");";
+// Destructor to stop the writer threads, which flush any buffered rows
+DataStorage::~DataStorage() {
+    writers.clear();
+    rollupEngine.reset();
+    partitionMaintainer.reset();
+}
 
-    // Execute partition creation if needed
-    if (!partitionNeedsAdding) {
-        std::cout << "No new partitions to add." << std::endl;
-        return;
+bool DataStorage::handleTimestamp(const msgpack::object_map& fields, Snapshot& snapshot) {
+    uint64_t receivedTimestamp;
+    const char* error = decodeTimestamp(fields, receivedTimestamp);
+    if (error != nullptr) {
+        LOG_ERROR_LIMITED("Timestamp handling error: " << error);
+        return false;
     }
 
-    std::string queryStr = partitionQuery.str();
-    std::cout << "Generated Query: " << queryStr << std::endl;
-
-    if (mysql_query(conn, queryStr.c_str())) {
-        std::cerr << "Failed to add partitions: " << mysql_error(conn) << std::endl;
-    } else {
-        std::cout << "Partitions added successfully." << std::endl;
-    }
+    // Keep the raw epoch milliseconds; conversion to local time happens when the row is written
+    snapshot.timestampMs = receivedTimestamp;
+    return true;
 }
 
-
 std::string DataStorage::getCurrentPartitionName() {
     // Get current time
     std::time_t now = std::time(nullptr);
@@ -187,152 +82,158 @@ std::string DataStorage::getCurrentPartitionName() {
     return std::string(partitionName);
 }
 
-// Function to insert all data into the database
-void DataStorage::insertAllData() {
-
-    // Check and create monthly partition if needed
-    createMonthlyPartitions(conn);
-
-    
+DataStorage::Device& DataStorage::deviceState(DeviceKey key) {
+    auto found = devices.find(key);
+    if (found != devices.end()) {
+        return found->second;
+    }
+    Device& device = devices[key];
+    device.current = Snapshot{};
+    device.receivedMessages = 0;
+    device.pendingMessages = 0;
+    if (!isProvisional(key)) {
+        // Rows carry the serial number even before the device's system info arrives
+        device.current.serialNumber = static_cast<uint32_t>(key);
+        LOG_INFO("New device " << key << ", " << devices.size() << " devices");
+    }
+    return device;
+}
 
-   std::string currentPartition = getCurrentPartitionName();
+void DataStorage::adoptDevice(DeviceKey from, DeviceKey to) {
+    auto found = devices.find(from);
+    if (found == devices.end()) {
+        return;
+    }
+    Device provisional = std::move(found->second);
+    devices.erase(found);
+
+    // The provisional fields arrived last, so they win over what the device already held
+    Device& device = deviceState(to);
+    mergeMessageFields(provisional.receivedMessages, provisional.current, device.current);
+    device.current.serialNumber = static_cast<uint32_t>(to);
+    device.receivedMessages |= provisional.receivedMessages;
+    if (provisional.pendingMessages > 0) {
+        if (device.pendingMessages == 0 || provisional.firstPending < device.firstPending) {
+            device.firstPending = provisional.firstPending;
+        }
+        device.pendingMessages += provisional.pendingMessages;
+    }
 
-    std::stringstream queryStream;
-    queryStream << "INSERT INTO `" << tableName << "` ("
-            << "flowRate, version, powerReading, frequency, pulseWidth, "
-            << "dcVoltage, dcCurrent, channelAForwardVoltage, channelAReferenceVoltage, "
-            << "channelBForwardVoltage, channelBReferenceVoltage, "
-            << "channelCForwardVoltage, channelCReferenceVoltage, "
-            << "channelDForwardVoltage, channelDReferenceVoltage, "
-            << "serialNumber, systemType, duty, tubePressure, wavelength, "
-            << "timestamp) VALUES (";
+    for (Snapshot& row : provisional.heldRows) {
+        row.serialNumber = static_cast<uint32_t>(to);
+        storeRow(to, row);
+    }
+}
 
-    
-    queryStream << laserheadFlow.flowRate << ", " 
-                << "'" << version.version << "', "        
-                << power.powerReading << ", "               
-                << pwmModulation.frequency << ", "          
-                << pwmModulation.pulseWidth << ", "         
-                << dcInfo.dcVoltage << ", "                 
-                << dcInfo.dcCurrent << ", "                 
-                << rfInfo.channelAForwardVoltage << ", "    
-                << rfInfo.channelAReferenceVoltage << ", "  
-                << rfInfo.channelBForwardVoltage << ", "    
-                << rfInfo.channelBReferenceVoltage << ", "  
-                << rfInfo.channelCForwardVoltage << ", "    
-                << rfInfo.channelCReferenceVoltage << ", "  
-                << rfInfo.channelDForwardVoltage << ", "    
-                << rfInfo.channelDReferenceVoltage << ", "  
-                << systemInfo.serialNumber << ", "          
-                << systemInfo.systemType << ", "            
-                << systemInfo.duty << ", "                  
-                << systemInfo.tubePressure << ", "          
-                << systemInfo.wavelength << ", "            
-                << "'" << timestamp.formatted << "')";      
+std::chrono::steady_clock::time_point DataStorage::captureDueRows() {
+    auto now = std::chrono::steady_clock::now();
+    auto next = std::chrono::steady_clock::time_point::max();
+    for (auto& entry : devices) {
+        Device& device = entry.second;
+        if (device.pendingMessages == 0) {
+            continue;
+        }
+        auto due = device.firstPending + policy.maxLatency;
+        if (due <= now) {
+            insertRow(entry.first, device);
+        } else if (due < next) {
+            next = due;
+        }
+    }
+    return next;
+}
 
-    std::string query = queryStream.str();
+// Capture the device's current data as a row
+void DataStorage::insertRow(DeviceKey key, Device& device) {
+    device.pendingMessages = 0;
+    pipelineMetrics().rowsCaptured.add();
+    if (!isProvisional(key)) {
+        storeRow(key, device.current);
+        return;
+    }
 
-    std::cout << "Generated Query: " << query << std::endl;
-    
-    if (mysql_query(conn, query.c_str())) {
-        std::cerr << "INSERT failed: " << mysql_error(conn) 
-                  << "\nQuery: " << query << std::endl;
-        
-        // Additional diagnostic information
-        std::cout << "Debug Info:" << std::endl;
-        std::cout << "Timestamp: " << timestamp.formatted << std::endl;
-        std::cout << "Partition: " << currentPartition << std::endl;
+    // Which writer the row belongs to is only known once the serialNumber arrives
+    if (device.heldRows.size() >= MAX_HELD_ROWS) {
+        device.heldRows.pop_front();
+        pipelineMetrics().rowsDropped.add();
+        LOG_WARNING_LIMITED("No serialNumber from endpoint " << (key & UINT32_MAX)
+                            << " yet, dropping its oldest held row");
     }
+    device.heldRows.push_back(device.current);
 }
 
+// Hand a row to the device's writer thread for insertion
+void DataStorage::storeRow(DeviceKey key, const Snapshot& snapshot) {
+    if (recentCache) {
+        recentCache->append(snapshot);
+    }
 
+    if (deadbandFilter) {
+        bool store = deadbandFilter->shouldStore(snapshot);
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastDeadbandReport >= DEADBAND_REPORT_INTERVAL) {
+            DeadbandFilter::Stats stats = deadbandFilter->stats();
+            LOG_INFO("Deadband filter: stored " << stats.stored << " of " << stats.considered << " rows ("
+                     << stats.heartbeats << " heartbeats), "
+                     << (stats.considered > 0 ? 100 * stats.suppressed / stats.considered : 0)
+                     << "% fewer writes");
+            lastDeadbandReport = now;
+        }
 
-void DataStorage::handleLaserheadFlow(const std::unordered_map<std::string, msgpack::object>& dataMap) {
-    try {
-        laserheadFlow.flowRate = dataMap.at("flowRate").as<uint32_t>();
-    } catch (const std::out_of_range&) {
-        // Handle missing flowRate key
-    } catch (const msgpack::type_error&) {
-        // Handle type mismatch for flowRate
+        if (!store) {
+            pipelineMetrics().rowsSuppressed.add();
+            return;
+        }
     }
-    handleTimestamp(dataMap);
-}
 
-void DataStorage::handleVersion(const std::unordered_map<std::string, msgpack::object>& dataMap) {
-    try {
-        version.version = dataMap.at("version").as<std::string>();
-    } catch (const std::out_of_range&) {
-        // Handle missing version key
-    } catch (const msgpack::type_error&) {
-        // Handle type mismatch for version
+    // Never wait for the database here; a full queue drops the row and counts it
+    if (!writers[key % writers.size()]->enqueue(snapshot)) {
+        pipelineMetrics().rowsDropped.add();
     }
-    handleTimestamp(dataMap);
 }
 
-void DataStorage::handlePower(const std::unordered_map<std::string, msgpack::object>& dataMap) {
-    try {
-        power.powerReading = dataMap.at("powerReading").as<uint32_t>();
-    } catch (const std::out_of_range&) {
-        // Handle missing power key
-    } catch (const msgpack::type_error&) {
-        // Handle type mismatch for power
-    }
-    handleTimestamp(dataMap);
+void DataStorage::setRecentCache(std::shared_ptr<RecentCache> cache) {
+    recentCache = cache;
 }
 
-void DataStorage::handlePWMModulation(const std::unordered_map<std::string, msgpack::object>& dataMap) {
-    try {
-        pwmModulation.frequency = dataMap.at("frequency").as<uint32_t>();
-        pwmModulation.pulseWidth = dataMap.at("pulseWidth").as<uint32_t>();
-    } catch (const std::out_of_range&) {
-        // Handle missing one or more PWM Modulation keys
-    } catch (const msgpack::type_error&) {
-        // Handle type mismatch for PWM Modulation data
-    }
-    handleTimestamp(dataMap);
+void DataStorage::setDeadbandFilter(std::unique_ptr<DeadbandFilter> filter) {
+    deadbandFilter = std::move(filter);
+    lastDeadbandReport = std::chrono::steady_clock::now();
 }
 
-void DataStorage::handleDcInfo(const std::unordered_map<std::string, msgpack::object>& dataMap) {
-    try {
-        dcInfo.dcVoltage = dataMap.at("dcVoltage").as<uint32_t>();
-        dcInfo.dcCurrent = dataMap.at("dcCurrent").as<uint32_t>();
-    } catch (const std::out_of_range&) {
-        // Handle missing one or more DC Info keys
-    } catch (const msgpack::type_error&) {
-        // Handle type mismatch for DC Info data
-    }
-    handleTimestamp(dataMap);
+DataStorage::QueueStats DataStorage::queueStats() const {
+    QueueStats total{};
+    for (const auto& writer : writers) {
+        QueueStats stats = writer->queueStats();
+        total.depth += stats.depth;
+        total.capacity += stats.capacity;
+        total.highWaterMark = std::max(total.highWaterMark, stats.highWaterMark);
+        total.queued += stats.queued;
+        total.overflows += stats.overflows;
+    }
+    return total;
 }
 
-void DataStorage::handleRfInfo(const std::unordered_map<std::string, msgpack::object>& dataMap) {
-    try {
-        rfInfo.channelAForwardVoltage = dataMap.at("channelAForwardVoltage").as<uint32_t>();
-        rfInfo.channelAReferenceVoltage = dataMap.at("channelAReferenceVoltage").as<uint32_t>();
-        rfInfo.channelBForwardVoltage = dataMap.at("channelBForwardVoltage").as<uint32_t>();
-        rfInfo.channelBReferenceVoltage = dataMap.at("channelBReferenceVoltage").as<uint32_t>();
-        rfInfo.channelCForwardVoltage = dataMap.at("channelCForwardVoltage").as<uint32_t>();
-        rfInfo.channelCReferenceVoltage = dataMap.at("channelCReferenceVoltage").as<uint32_t>();
-        rfInfo.channelDForwardVoltage = dataMap.at("channelDForwardVoltage").as<uint32_t>();
-        rfInfo.channelDReferenceVoltage = dataMap.at("channelDReferenceVoltage").as<uint32_t>();
-    } catch (const std::out_of_range&) {
-        // Handle missing RF Info keys
-    } catch (const msgpack::type_error&) {
-        // Handle type mismatch for RF Info data
+// Apply one message to the device's snapshot. The per-commandID decoders are
+// generated from the telemetry schema.
+bool DataStorage::handleMessage(DeviceKey key, uint16_t commandID, const msgpack::object_map& fields) {
+    Device& device = deviceState(key);
+    if (!decodeMessage(commandID, fields, device.current)) {
+        return false;
+    }
+    device.receivedMessages |= telemetryMessageBit(commandID);
+    // Aggregates need the message's own timestamp, not a stale one, and a
+    // known serial number: buckets are not restamped when the device is adopted
+    if (handleTimestamp(fields, device.current) && !isProvisional(key)) {
+        rollupEngine->record(commandID, device.current);
     }
-    handleTimestamp(dataMap);
-}
 
-void DataStorage::handleSystemInfo(const std::unordered_map<std::string, msgpack::object>& dataMap) {
-    try {
-        systemInfo.serialNumber = dataMap.at("serialNumber").as<uint32_t>();
-        systemInfo.systemType = dataMap.at("systemType").as<uint32_t>();
-        systemInfo.duty = dataMap.at("duty").as<uint32_t>();
-        systemInfo.tubePressure = dataMap.at("tubePressure").as<uint32_t>();
-        systemInfo.wavelength = dataMap.at("wavelength").as<uint32_t>();
-    } catch (const std::out_of_range&) {
-        // Handle missing systemStatus key
-    } catch (const msgpack::type_error&) {
-        // Handle type mismatch for systemStatus
+    if (device.pendingMessages++ == 0) {
+        device.firstPending = std::chrono::steady_clock::now();
     }
-    handleTimestamp(dataMap);
-}
\ No newline at end of file
+    if (device.pendingMessages >= policy.messagesPerRow) {
+        insertRow(key, device);
+    }
+    return true;
+}
@@ -2,105 +2,102 @@
 #define DATASTORAGE_H
 
 #include <string>
-#include <unordered_map>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <deque>
 #include <msgpack.hpp>
 #include <mariadb/mysql.h>
+#include <unordered_map>
+#include "snapshot.h"
+#include "storageWriter.h"
+#include "dbConnection.h"
+#include "partitionMaintainer.h"
+#include "recentCache.h"
+#include "rollupEngine.h"
+#include "deadbandFilter.h"
+#include "flushPolicy.h"
 
 class DataStorage {
 public:
-
-    DataStorage();
+    // Devices are keyed by serialNumber. Messages from a device whose
+    // serialNumber has not arrived yet are kept under a provisional key for
+    // their endpoint until adoptDevice() moves them to the real one; rows
+    // captured under a provisional key are held until then, so that every row
+    // of a device carries its serialNumber and goes through the same writer.
+    // Those messages are left out of the rollups.
+    using DeviceKey = uint64_t;
+    static DeviceKey provisionalDevice(size_t endpoint) { return (uint64_t(1) << 32) | endpoint; }
+
+    // Rows are written by writerCount threads, each with its own connection,
+    // batch and spool; every device always goes to the same writer.
+    DataStorage(const FlushPolicy& flushPolicy = FlushPolicy(), size_t queueCapacity = 4096,
+                const DbConfig& dbConfig = DbConfig(),
+                const std::string& spoolPath = "laser_data.spool", size_t writerCount = 1);
     ~DataStorage();
-    
-    struct LaserheadFlow {
-        uint32_t flowRate;
-    };
-    
-    struct Version {
-        std::string version;
-    };
 
-    struct Power {
-        uint32_t powerReading;
-    };
+    using QueueStats = StorageWriter::QueueStats;
+    
+    std::string tableName = "laser_data";
 
-    struct PWMModulation {
-        uint32_t frequency;
-        uint32_t pulseWidth;
-    };
+    // Decode a message into the device's latest values; false for an unknown commandID.
+    // A row is captured once the device has sent flushPolicy().messagesPerRow messages.
+    bool handleMessage(DeviceKey key, uint16_t commandID, const msgpack::object_map& fields);
+    // Merge the state gathered under a provisional key into the device's
+    // serialNumber and store the rows held for it
+    void adoptDevice(DeviceKey from, DeviceKey to);
+    // Capture a row for every device whose oldest uncaptured message is maxLatency old.
+    // Returns when the next device will be due, or time_point::max() if none has messages waiting.
+    std::chrono::steady_clock::time_point captureDueRows();
+
+    // Every inserted row is also kept in cache for recent-data queries
+    void setRecentCache(std::shared_ptr<RecentCache> cache);
+    // Store only rows that changed past the filter's deadbands; call before receiving starts
+    void setDeadbandFilter(std::unique_ptr<DeadbandFilter> filter);
+    // Summed over all writers; highWaterMark is the largest of any writer
+    QueueStats queueStats() const;
+    const FlushPolicy& flushPolicy() const { return policy; }
+    std::string getCurrentPartitionName();
 
+    double GetMaxStorage();
 
-    struct DCInfo {
-        uint32_t dcVoltage;
-        uint32_t dcCurrent;
+private:
+    // Latest value of every field of one device, updated in place by handleMessage()
+    struct Device {
+        Snapshot current;
+        uint32_t receivedMessages;  ///< telemetryMessageBit() of every message decoded into current
+        size_t pendingMessages;     ///< Messages applied since the last captured row
+        std::chrono::steady_clock::time_point firstPending;
+        std::deque<Snapshot> heldRows;  ///< Provisional devices only: rows waiting for the serialNumber
     };
 
-    struct RFInfo {
-        uint32_t channelAForwardVoltage;   ///< Forward voltage for Channel A
-        uint32_t channelAReferenceVoltage;  ///< Reference voltage for Channel A
-        uint32_t channelBForwardVoltage;   ///< Forward voltage for Channel B
-        uint32_t channelBReferenceVoltage;  ///< Reference voltage for Channel B
-        uint32_t channelCForwardVoltage;   ///< Forward voltage for Channel C
-        uint32_t channelCReferenceVoltage;  ///< Reference voltage for Channel C
-        uint32_t channelDForwardVoltage;   ///< Forward voltage for Channel D
-        uint32_t channelDReferenceVoltage;  ///< Reference voltage for Channel D
-    };
+    Device& deviceState(DeviceKey key);
+    bool handleTimestamp(const msgpack::object_map& fields, Snapshot& snapshot);
+    void insertRow(DeviceKey key, Device& device);
+    void storeRow(DeviceKey key, const Snapshot& snapshot);
 
-    struct systemInfo {
-        uint32_t serialNumber;
-        uint32_t systemType;
-        uint32_t duty;
-        uint32_t tubePressure;
-        uint32_t wavelength;
-    };
+    std::shared_ptr<RecentCache> recentCache;
+    std::unique_ptr<DeadbandFilter> deadbandFilter;
+    std::chrono::steady_clock::time_point lastDeadbandReport;
 
-struct Timestamp {
-    std::time_t value;
-    std::string formatted;
-};
+    DbConfig dbConfig;
+    FlushPolicy policy;
+    std::unordered_map<DeviceKey, Device> devices;
 
+    // Minute and hour aggregates, fed by handleMessage()
+    std::unique_ptr<RollupEngine> rollupEngine;
 
-    std::string tableName = "laser_data";
-    LaserheadFlow laserheadFlow;
-    Version version;
-    Power power;
-    PWMModulation pwmModulation;
-    DCInfo dcInfo;
-    RFInfo rfInfo;
-    systemInfo systemInfo;
-    Timestamp timestamp;
-
-    void handleLaserheadFlow(const std::unordered_map<std::string, msgpack::object>& dataMap);
-    void handleVersion(const std::unordered_map<std::string, msgpack::object>& dataMap);
-    void handlePower(const std::unordered_map<std::string, msgpack::object>& dataMap);
-    void handlePWMModulation(const std::unordered_map<std::string, msgpack::object>& dataMap);
-    void handleDcInfo(const std::unordered_map<std::string, msgpack::object>& dataMap);
-    void handleRfInfo(const std::unordered_map<std::string, msgpack::object>& dataMap);
-    void handleSystemInfo(const std::unordered_map<std::string, msgpack::object>& dataMap);
-
-    void handleTimestamp(const std::unordered_map<std::string, msgpack::object>& dataMap);
-
-    void insertAllData();
-    void checkAndCreateMonthlyPartitions();
-    std::string getCurrentPartitionName();
+    // Rows before this time have a partition; refreshed by partitionMaintainer.
+    // Declared before the writers, which use both.
+    std::atomic<std::time_t> partitionHorizon;
+    std::unique_ptr<PartitionMaintainer> partitionMaintainer;
 
-    double GetMaxStorage();
-    
-
-    // Database connection
-    MYSQL* conn;
+    // Indexed by device key modulo their count
+    std::vector<std::unique_ptr<StorageWriter>> writers;
 };
 
 
 
 
 #endif // DATASTORAGE_H
-    
-
-    
-
-    
-
-    
-
-    
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include "dbConnection.h"
+#include "logger.h"
+#include <mariadb/errmsg.h>
+#include <poll.h>
+#include <algorithm>
+
+namespace {
+// Limits for the non-blocking connection, in seconds; past them the pending call fails
+constexpr unsigned int CONNECT_TIMEOUT_SECONDS = 5;
+constexpr unsigned int READ_TIMEOUT_SECONDS = 30;
+constexpr unsigned int WRITE_TIMEOUT_SECONDS = 30;
+}
+
+MYSQL* openConnection(const DbConfig& config) {
+    MYSQL* conn = mysql_init(NULL);
+    if (conn == NULL) {
+        LOG_ERROR("mysql_init() failed");
+        return NULL;
+    }
+
+    if (mysql_real_connect(conn, config.host.c_str(), config.user.c_str(), config.password.c_str(),
+                           config.name.c_str(), 0, NULL, 0) == NULL) {
+        LOG_ERROR("mysql_real_connect() failed: " << mysql_error(conn));
+        mysql_close(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+int startConnection(const DbConfig& config, MYSQL*& conn, MYSQL*& connected) {
+    connected = NULL;
+    conn = mysql_init(NULL);
+    if (conn == NULL) {
+        LOG_ERROR("mysql_init() failed");
+        return 0;
+    }
+
+    mysql_options(conn, MYSQL_OPT_NONBLOCK, 0);
+    mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, &CONNECT_TIMEOUT_SECONDS);
+    mysql_options(conn, MYSQL_OPT_READ_TIMEOUT, &READ_TIMEOUT_SECONDS);
+    mysql_options(conn, MYSQL_OPT_WRITE_TIMEOUT, &WRITE_TIMEOUT_SECONDS);
+    return mysql_real_connect_start(&connected, conn, config.host.c_str(), config.user.c_str(),
+                                    config.password.c_str(), config.name.c_str(), 0, NULL, 0);
+}
+
+bool connectionLost(unsigned int error) {
+    switch (error) {
+        case CR_CONNECTION_ERROR:
+        case CR_CONN_HOST_ERROR:
+        case CR_SERVER_GONE_ERROR:
+        case CR_SERVER_LOST:
+        case CR_SERVER_LOST_EXTENDED:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void SocketWait::set(MYSQL* conn, int status) {
+    m_status = status;
+    if (status & MYSQL_WAIT_TIMEOUT) {
+        m_timeoutAt = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(mysql_get_timeout_value_ms(conn));
+    }
+}
+
+int SocketWait::wait(MYSQL* conn, std::chrono::milliseconds maxWait) const {
+    auto now = std::chrono::steady_clock::now();
+    if (m_status & MYSQL_WAIT_TIMEOUT) {
+        if (now >= m_timeoutAt) {
+            return MYSQL_WAIT_TIMEOUT;
+        }
+        auto untilTimeout = std::chrono::duration_cast<std::chrono::milliseconds>(m_timeoutAt - now);
+        maxWait = std::min(maxWait, untilTimeout + std::chrono::milliseconds(1));
+    }
+
+    pollfd socket = {};
+    socket.fd = mysql_get_socket(conn);
+    if (m_status & MYSQL_WAIT_READ) {
+        socket.events |= POLLIN;
+    }
+    if (m_status & MYSQL_WAIT_WRITE) {
+        socket.events |= POLLOUT;
+    }
+    if (m_status & MYSQL_WAIT_EXCEPT) {
+        socket.events |= POLLPRI;
+    }
+
+    int ready = poll(&socket, 1, static_cast<int>(maxWait.count()));
+    if (ready < 0) {
+        return 0;
+    }
+    if (ready == 0) {
+        bool timedOut = (m_status & MYSQL_WAIT_TIMEOUT) && std::chrono::steady_clock::now() >= m_timeoutAt;
+        return timedOut ? MYSQL_WAIT_TIMEOUT : 0;
+    }
+
+    int events = 0;
+    // A closed or failed socket wakes the call too, which then reports the error
+    if (socket.revents & (POLLIN | POLLERR | POLLHUP)) {
+        events |= m_status & MYSQL_WAIT_READ;
+    }
+    if (socket.revents & (POLLOUT | POLLERR | POLLHUP)) {
+        events |= m_status & MYSQL_WAIT_WRITE;
+    }
+    if (socket.revents & POLLPRI) {
+        events |= MYSQL_WAIT_EXCEPT;
+    }
+    return events;
+}
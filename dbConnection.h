@@ -0,0 +1,47 @@
+#ifndef DB_CONNECTION_H
+#define DB_CONNECTION_H
+
+#include <string>
+#include <chrono>
+#include <mariadb/mysql.h>
+
+// Credentials for the local MariaDB instance
+struct DbConfig {
+    std::string host = "localhost";
+    std::string user = "my_user";
+    std::string password = "my_password";
+    std::string name = "my_database";
+};
+
+// Open a new connection; logs and returns nullptr on failure
+MYSQL* openConnection(const DbConfig& config);
+
+// Begin opening a connection for the non-blocking API (MYSQL_OPT_NONBLOCK).
+// conn is set to the new handle, or nullptr if none could be created.
+// Returns the wait status for mysql_real_connect_cont(), or 0 once finished,
+// with connected set to conn on success and nullptr on failure.
+int startConnection(const DbConfig& config, MYSQL*& conn, MYSQL*& connected);
+
+// True if error (a client error code) means the connection is gone rather
+// than the statement being refused by a reachable server
+bool connectionLost(unsigned int error);
+
+// What a non-blocking call is waiting for: the MYSQL_WAIT_* status its
+// _start or _cont function returned, and when MYSQL_WAIT_TIMEOUT expires
+class SocketWait {
+public:
+    SocketWait() : m_status(0) {}
+
+    // Record the status of a _start or _cont call; 0 means it has finished
+    void set(MYSQL* conn, int status);
+    bool pending() const { return m_status != 0; }
+
+    // Wait at most maxWait; returns the events to pass to the _cont call, or 0 if none happened yet
+    int wait(MYSQL* conn, std::chrono::milliseconds maxWait) const;
+
+private:
+    int m_status;
+    std::chrono::steady_clock::time_point m_timeoutAt;
+};
+
+#endif // DB_CONNECTION_H
@@ -0,0 +1,83 @@
+#include "deadbandFilter.h"
+#include <cstring>
+#include <cmath>
+#include <type_traits>
+
+DeadbandFilter::DeadbandFilter(std::chrono::milliseconds heartbeat)
+    : m_heartbeatMs(static_cast<uint64_t>(heartbeat.count()))
+    , m_considered(0)
+    , m_stored(0)
+    , m_heartbeats(0) {
+    for (auto& deadband : m_deadbands) {
+        deadband = Deadband{DeadbandType::Absolute, 0.0};
+    }
+}
+
+bool DeadbandFilter::setDeadband(const std::string& field, DeadbandType type, double width) {
+    size_t index = 0;
+#define DEADBAND_SET_FIELD(command, name, fieldType) \
+    if (field == #name) { \
+        if (!std::is_same<fieldType, uint32_t>::value) { \
+            return false; \
+        } \
+        m_deadbands[index] = Deadband{type, width}; \
+        return true; \
+    } \
+    ++index;
+    TELEMETRY_FIELDS(DEADBAND_SET_FIELD)
+#undef DEADBAND_SET_FIELD
+    return false;
+}
+
+bool DeadbandFilter::exceeds(const Deadband& deadband, uint32_t reference, uint32_t value) {
+    double change = std::fabs(static_cast<double>(value) - static_cast<double>(reference));
+    double width = deadband.type == DeadbandType::Percent ? reference * deadband.width / 100.0 : deadband.width;
+    return change > width;
+}
+
+bool DeadbandFilter::exceeds(const Deadband&, const TelemetryString& reference, const TelemetryString& value) {
+    return reference.length != value.length || std::memcmp(reference.data, value.data, value.length) != 0;
+}
+
+bool DeadbandFilter::shouldStore(const Snapshot& snapshot) {
+    m_considered.fetch_add(1, std::memory_order_relaxed);
+
+    auto found = m_references.find(snapshot.serialNumber);
+    bool store = found == m_references.end();
+    bool heartbeat = false;
+    if (!store) {
+        const Snapshot& reference = found->second;
+        size_t field = 0;
+#define DEADBAND_CHECK_FIELD(command, name, type) \
+        store = store || exceeds(m_deadbands[field], reference.name, snapshot.name); \
+        ++field;
+        TELEMETRY_FIELDS(DEADBAND_CHECK_FIELD)
+#undef DEADBAND_CHECK_FIELD
+
+        if (!store && snapshot.timestampMs >= reference.timestampMs + m_heartbeatMs) {
+            store = true;
+            heartbeat = true;
+        }
+    }
+
+    if (!store) {
+        return false;
+    }
+
+    m_references[snapshot.serialNumber] = snapshot;
+    m_stored.fetch_add(1, std::memory_order_release);
+    if (heartbeat) {
+        m_heartbeats.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+DeadbandFilter::Stats DeadbandFilter::stats() const {
+    // Read stored before considered so suppressed can never go negative
+    Stats stats;
+    stats.heartbeats = m_heartbeats.load(std::memory_order_relaxed);
+    stats.stored = m_stored.load(std::memory_order_acquire);
+    stats.considered = m_considered.load(std::memory_order_relaxed);
+    stats.suppressed = stats.considered - stats.stored;
+    return stats;
+}
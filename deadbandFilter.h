@@ -0,0 +1,60 @@
+#ifndef DEADBAND_FILTER_H
+#define DEADBAND_FILTER_H
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include "snapshot.h"
+
+enum class DeadbandType {
+    Absolute,   ///< Change of more than width units
+    Percent,    ///< Change of more than width percent of the last stored value
+};
+
+// Change-driven storage: a row is stored only when some field has moved past
+// its deadband since the last stored row, or when heartbeat has passed since
+// then. Fields without a deadband count as changed on any difference, so by
+// default only exact repeats are skipped. String fields always compare exactly.
+// Each serialNumber has its own reference row, so devices are filtered separately.
+//
+// shouldStore() is called from the receive thread; stats() from any thread.
+class DeadbandFilter {
+public:
+    struct Stats {
+        uint64_t considered;    ///< Rows offered to the filter
+        uint64_t stored;        ///< Rows that passed, including heartbeats
+        uint64_t heartbeats;    ///< Rows stored only because of the heartbeat
+        uint64_t suppressed;    ///< Rows skipped
+    };
+
+    explicit DeadbandFilter(std::chrono::milliseconds heartbeat);
+
+    // False for an unknown or non-numeric field
+    bool setDeadband(const std::string& field, DeadbandType type, double width);
+
+    // True if the row should be stored; it then becomes its device's new reference
+    bool shouldStore(const Snapshot& snapshot);
+
+    Stats stats() const;
+
+private:
+    struct Deadband {
+        DeadbandType type;
+        double width;
+    };
+
+    static bool exceeds(const Deadband& deadband, uint32_t reference, uint32_t value);
+    static bool exceeds(const Deadband& deadband, const TelemetryString& reference, const TelemetryString& value);
+
+    const uint64_t m_heartbeatMs;
+    Deadband m_deadbands[TELEMETRY_FIELD_COUNT];    ///< Indexed like TELEMETRY_FIELDS
+    std::unordered_map<uint32_t, Snapshot> m_references;    ///< Last stored row per serialNumber
+
+    std::atomic<uint64_t> m_considered;
+    std::atomic<uint64_t> m_stored;
+    std::atomic<uint64_t> m_heartbeats;
+};
+
+#endif // DEADBAND_FILTER_H
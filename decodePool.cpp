@@ -0,0 +1,120 @@
+#include "decodePool.h"
+#include "metrics.h"
+#include "msgpackFields.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+std::string workAddress(const void* pool, size_t worker) {
+    return "inproc://decode-" + std::to_string(reinterpret_cast<uintptr_t>(pool)) + "-" + std::to_string(worker);
+}
+
+std::string completionsAddress(const void* pool) {
+    return "inproc://decoded-" + std::to_string(reinterpret_cast<uintptr_t>(pool));
+}
+}
+
+msgpack::object unpackFrame(msgpack::zone& zone, const zmq::message_t& frame) {
+    std::size_t offset = 0;
+    bool referenced = false;
+    return msgpack::unpack(zone, static_cast<const char*>(frame.data()), frame.size(), offset, referenced,
+                           referenceBuffer);
+}
+
+DecodePool::DecodePool(zmq::context_t& context, size_t workers, size_t slotsPerWorker)
+    : m_context(context)
+    , m_slots(std::max<size_t>(workers, 1) * std::max<size_t>(slotsPerWorker, 1))
+    , m_completions(context, zmq::socket_type::pull)
+    , m_submitted(0)
+    , m_released(0) {
+    workers = std::max<size_t>(workers, 1);
+    // inproc needs the bind before any connect; workers connect once they start
+    m_completions.set(zmq::sockopt::linger, 0);
+    m_completions.bind(completionsAddress(this));
+    for (size_t i = 0; i < workers; ++i) {
+        zmq::socket_t socket(context, zmq::socket_type::push);
+        socket.set(zmq::sockopt::linger, 0);
+        socket.bind(workAddress(this, i));
+        m_work.push_back(std::move(socket));
+    }
+    for (size_t i = 0; i < workers; ++i) {
+        m_threads.emplace_back(&DecodePool::work, this, i);
+    }
+}
+
+// An empty request stops a worker once it has finished the frames before it
+DecodePool::~DecodePool() {
+    for (auto& socket : m_work) {
+        socket.send(zmq::message_t(), zmq::send_flags::none);
+    }
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+DecodePool::Frame* DecodePool::nextFree() {
+    if (m_submitted - m_released >= m_slots.size()) {
+        return nullptr;
+    }
+    return &m_slots[m_submitted % m_slots.size()];
+}
+
+// Slots go to the workers in turn, so each worker's requests arrive in submission order.
+// A worker never has more requests queued than slots, which is below the inproc HWM,
+// so the send does not block.
+void DecodePool::submit() {
+    uint64_t index = m_submitted++;
+    m_work[index % m_work.size()].send(zmq::buffer(&index, sizeof(index)), zmq::send_flags::none);
+}
+
+void DecodePool::drainCompletions() {
+    while (m_completions.recv(m_notice, zmq::recv_flags::dontwait)) {
+    }
+}
+
+DecodePool::Frame* DecodePool::nextDecoded() {
+    if (m_released == m_submitted) {
+        return nullptr;
+    }
+    Frame& frame = m_slots[m_released % m_slots.size()];
+    return frame.decoded.load(std::memory_order_acquire) ? &frame : nullptr;
+}
+
+void DecodePool::release() {
+    m_slots[m_released % m_slots.size()].decoded.store(false, std::memory_order_relaxed);
+    ++m_released;
+}
+
+// Worker thread: unpack each requested slot in place, then tell the receive thread
+void DecodePool::work(size_t worker) {
+    zmq::socket_t requests(m_context, zmq::socket_type::pull);
+    requests.set(zmq::sockopt::linger, 0);
+    requests.connect(workAddress(this, worker));
+    zmq::socket_t done(m_context, zmq::socket_type::push);
+    done.set(zmq::sockopt::linger, 0);
+    done.connect(completionsAddress(this));
+
+    PipelineMetrics& metrics = pipelineMetrics();
+    zmq::message_t request;
+    while (requests.recv(request, zmq::recv_flags::none)) {
+        uint64_t index;
+        if (request.size() != sizeof(index)) {
+            break;
+        }
+        std::memcpy(&index, request.data(), sizeof(index));
+
+        Frame& frame = m_slots[index % m_slots.size()];
+        frame.zone.clear();
+        try {
+            StageTimer timer(metrics.decode);
+            frame.message = unpackFrame(frame.zone, frame.data);
+            frame.valid = true;
+        } catch (const std::exception& e) {
+            frame.valid = false;
+            frame.error = e.what();
+        }
+        frame.decoded.store(true, std::memory_order_release);
+        done.send(zmq::message_t(), zmq::send_flags::none);
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef DECODE_POOL_H
+#define DECODE_POOL_H
+
+#include <zmq.hpp>
+#include <msgpack.hpp>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Unpack a received frame into zone. Strings in the result point into frame,
+// which has to outlive it. Throws what msgpack::unpack throws.
+msgpack::object unpackFrame(msgpack::zone& zone, const zmq::message_t& frame);
+
+// Unpacks frames on worker threads while the receive thread keeps them in
+// arrival order. Frames live in a ring of slots: the receive thread receives
+// straight into the next free slot, submit() hands it to worker
+// (index % workers) over an inproc PUSH/PULL pair, and nextDecoded() returns
+// slots strictly in the order they were submitted. Arrival order on an
+// endpoint is the publisher's send order, so each device's messages still
+// reach DataStorage in timestamp order, and DataStorage itself stays on the
+// receive thread.
+class DecodePool {
+public:
+    struct Frame {
+        zmq::message_t data;            ///< Reused for every message received into this slot
+        size_t endpoint = 0;
+        msgpack::zone zone;
+        msgpack::object message;
+        bool valid = false;             ///< False if unpacking failed; error says why
+        std::string error;
+        std::atomic<bool> decoded{false};
+    };
+
+    // Frames up to slotsPerWorker * workers can be in flight at once
+    DecodePool(zmq::context_t& context, size_t workers, size_t slotsPerWorker);
+    ~DecodePool();
+
+    DecodePool(const DecodePool&) = delete;
+    DecodePool& operator=(const DecodePool&) = delete;
+
+    // Slot to receive the next message into, or nullptr while every slot is in flight
+    Frame* nextFree();
+    // Hand the slot from nextFree() to its worker
+    void submit();
+
+    // Readable whenever a worker has finished a frame; poll it alongside the endpoints
+    zmq::socket_t& completions() { return m_completions; }
+    // Take the completion notices off completions() without blocking
+    void drainCompletions();
+    // Oldest submitted slot once it has been decoded, or nullptr; release() it after use
+    Frame* nextDecoded();
+    void release();
+
+private:
+    void work(size_t worker);
+
+    zmq::context_t& m_context;
+    std::vector<Frame> m_slots;
+    std::vector<zmq::socket_t> m_work;  ///< PUSH to each worker, indexed like m_threads
+    zmq::socket_t m_completions;        ///< PULL from every worker
+    zmq::message_t m_notice;            ///< Reused by drainCompletions()
+    std::vector<std::thread> m_threads;
+
+    // Receive thread only
+    uint64_t m_submitted;
+    uint64_t m_released;
+};
+
+#endif // DECODE_POOL_H
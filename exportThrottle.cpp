@@ -0,0 +1,77 @@
+#include "exportThrottle.h"
+#include "logger.h"
+#include "metrics.h"
+#include <algorithm>
+#include <thread>
+
+namespace {
+// How often the rate follows the writer queue wait
+constexpr auto ADJUST_INTERVAL = std::chrono::seconds(1);
+// Lowest rate, as a fraction of the budget
+constexpr double MIN_RATE_FRACTION = 1.0 / 64;
+// Share of the budget regained per interval once the writers keep up
+constexpr double RECOVERY_FRACTION = 0.1;
+// Reads may run ahead of the rate by this much time's worth of bytes
+constexpr double BURST_SECONDS = 0.25;
+}
+
+ExportThrottle::ExportThrottle(uint64_t bytesPerSecond, std::chrono::milliseconds latencyTarget)
+    : m_budget(static_cast<double>(std::max<uint64_t>(bytesPerSecond, 1)))
+    , m_latencyTarget(latencyTarget)
+    , m_rate(m_budget)
+    , m_tokens(0)
+    , m_lastRefill(std::chrono::steady_clock::now())
+    , m_nextAdjust(m_lastRefill + ADJUST_INTERVAL)
+    , m_backingOff(false) {
+    // Start counting queue waits from now
+    pipelineMetrics().queueWait.quantileSince(m_queueWaitSeen, 0.99);
+}
+
+void ExportThrottle::acquire(size_t bytes) {
+    std::chrono::duration<double> wait(0);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto now = std::chrono::steady_clock::now();
+        if (now >= m_nextAdjust) {
+            adjustRate(now);
+        }
+
+        double elapsed = std::chrono::duration<double>(now - m_lastRefill).count();
+        m_tokens = std::min(m_tokens + elapsed * m_rate, m_rate * BURST_SECONDS);
+        m_lastRefill = now;
+
+        m_tokens -= static_cast<double>(bytes);
+        if (m_tokens < 0) {
+            wait = std::chrono::duration<double>(-m_tokens / m_rate);
+        }
+    }
+    if (wait.count() > 0) {
+        std::this_thread::sleep_for(wait);
+    }
+}
+
+uint64_t ExportThrottle::rate() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return static_cast<uint64_t>(m_rate);
+}
+
+// With m_mutex held: halve the rate while ingest is slowed down, otherwise recover
+void ExportThrottle::adjustRate(std::chrono::steady_clock::time_point now) {
+    m_nextAdjust = now + ADJUST_INTERVAL;
+    uint64_t p99 = pipelineMetrics().queueWait.quantileSince(m_queueWaitSeen, 0.99);
+
+    if (std::chrono::nanoseconds(p99) > m_latencyTarget) {
+        m_rate = std::max(m_rate / 2, m_budget * MIN_RATE_FRACTION);
+        if (!m_backingOff) {
+            LOG_INFO("Writer queue wait " << p99 / 1000000 << " ms, slowing archival to "
+                     << static_cast<uint64_t>(m_rate) / 1024 << " KiB/s");
+        }
+        m_backingOff = true;
+    } else {
+        m_rate = std::min(m_rate + m_budget * RECOVERY_FRACTION, m_budget);
+        if (m_backingOff && m_rate >= m_budget) {
+            LOG_INFO("Writers keeping up, archival back to " << static_cast<uint64_t>(m_rate) / 1024 << " KiB/s");
+            m_backingOff = false;
+        }
+    }
+}
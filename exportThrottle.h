@@ -0,0 +1,40 @@
+#ifndef EXPORT_THROTTLE_H
+#define EXPORT_THROTTLE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+// Paces archival reads so they leave the disk to live ingest. A token
+// bucket allows bytesPerSecond on average; every second the p99 of the
+// writer queue wait (pipelineMetrics().queueWait) is checked, and while it
+// is above latencyTarget the rate is halved, down to 1/64 of the budget.
+// Once the writers keep up again the rate climbs back by a tenth of the
+// budget per second. Shared by all export threads of a run.
+class ExportThrottle {
+public:
+    ExportThrottle(uint64_t bytesPerSecond, std::chrono::milliseconds latencyTarget);
+
+    // Account for bytes read, waiting until the budget allows them
+    void acquire(size_t bytes);
+
+    // Current rate in bytes per second, after any backoff
+    uint64_t rate();
+
+private:
+    void adjustRate(std::chrono::steady_clock::time_point now);
+
+    std::mutex m_mutex;
+    double m_budget;
+    std::chrono::nanoseconds m_latencyTarget;
+    double m_rate;
+    double m_tokens;                ///< Negative while readers are ahead of the rate
+    std::chrono::steady_clock::time_point m_lastRefill;
+    std::chrono::steady_clock::time_point m_nextAdjust;
+    std::vector<uint64_t> m_queueWaitSeen;
+    bool m_backingOff;
+};
+
+#endif // EXPORT_THROTTLE_H
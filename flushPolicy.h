@@ -0,0 +1,21 @@
+#ifndef FLUSH_POLICY_H
+#define FLUSH_POLICY_H
+
+#include <chrono>
+#include <cstddef>
+
+// When buffered telemetry moves on, whichever limit is reached first.
+//
+// A device's row is captured once it has sent messagesPerRow messages, or
+// once maxLatency has passed since its first message not yet in a row. The
+// writer sends a batch once it holds maxRows rows or maxBytes of row data,
+// or once its oldest row has waited maxLatency. A message therefore reaches
+// the database within about twice maxLatency, however slowly messages arrive.
+struct FlushPolicy {
+    std::chrono::milliseconds maxLatency = std::chrono::milliseconds(250);
+    size_t maxRows = 64;
+    size_t maxBytes = 64 * 1024;
+    size_t messagesPerRow = 8;
+};
+
+#endif // FLUSH_POLICY_H
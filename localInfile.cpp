@@ -0,0 +1,68 @@
+#include "localInfile.h"
+#include "logger.h"
+#include <charconv>
+#include <cstdio>
+#include <mariadb/errmsg.h>
+
+namespace {
+int infileInit(void** state, const char*, void* source) {
+    *state = source;
+    return 0;
+}
+
+// A negative return fails the statement with infileError()
+int infileRead(void* state, char* buffer, unsigned int size) {
+    InfileSource* source = static_cast<InfileSource*>(state);
+    size_t length = source->read(buffer, size);
+    return length == 0 && !source->error().empty() ? -1 : static_cast<int>(length);
+}
+
+void infileEnd(void*) {
+}
+
+int infileError(void* state, char* message, unsigned int size) {
+    std::snprintf(message, size, "%s", static_cast<InfileSource*>(state)->error().c_str());
+    return CR_UNKNOWN_ERROR;
+}
+}
+
+void setInfileSource(MYSQL* conn, InfileSource& source) {
+    mysql_set_local_infile_handler(conn, infileInit, infileRead, infileEnd, infileError, &source);
+}
+
+MYSQL* openInfileConnection(const DbConfig& config) {
+    MYSQL* conn = mysql_init(NULL);
+    if (conn == NULL) {
+        LOG_ERROR("mysql_init() failed");
+        return NULL;
+    }
+
+    // LOAD DATA LOCAL has to be allowed before connecting
+    unsigned int localInfile = 1;
+    mysql_options(conn, MYSQL_OPT_LOCAL_INFILE, &localInfile);
+    if (mysql_real_connect(conn, config.host.c_str(), config.user.c_str(), config.password.c_str(),
+                           config.name.c_str(), 0, NULL, 0) == NULL) {
+        LOG_ERROR("mysql_real_connect() failed: " << mysql_error(conn));
+        mysql_close(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+void appendInfileField(std::string& text, uint64_t value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    text.append(digits, result.ptr);
+}
+
+void appendInfileField(std::string& text, const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        switch (data[i]) {
+            case '\t': text += "\\t"; break;
+            case '\n': text += "\\n"; break;
+            case '\\': text += "\\\\"; break;
+            case '\0': text += "\\0"; break;
+            default: text += data[i]; break;
+        }
+    }
+}
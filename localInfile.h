@@ -0,0 +1,34 @@
+#ifndef LOCAL_INFILE_H
+#define LOCAL_INFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <mariadb/mysql.h>
+#include "dbConnection.h"
+
+// Input for LOAD DATA LOCAL INFILE produced in memory instead of read from
+// a file. The connection has to be opened with MYSQL_OPT_LOCAL_INFILE set.
+class InfileSource {
+public:
+    virtual ~InfileSource() = default;
+
+    // Up to size bytes of input; 0 ends the statement's input
+    virtual size_t read(char* buffer, size_t size) = 0;
+    // Why read() stopped early, if it did; reported as the statement's error
+    virtual std::string error() const { return std::string(); }
+};
+
+// Feed every following LOAD DATA LOCAL INFILE on conn from source, whatever
+// file name the statement gives. source has to outlive those statements.
+void setInfileSource(MYSQL* conn, InfileSource& source);
+
+// Open a connection that may use LOAD DATA LOCAL INFILE; logs and returns nullptr on failure
+MYSQL* openInfileConnection(const DbConfig& config);
+
+// Fields in LOAD DATA's default text format: tab-separated, one row per
+// line, with tab, newline, backslash and NUL escaped by a backslash
+void appendInfileField(std::string& text, uint64_t value);
+void appendInfileField(std::string& text, const char* data, size_t size);
+
+#endif // LOCAL_INFILE_H
@@ -0,0 +1,40 @@
+#include "localTimeCache.h"
+#include <cstdio>
+#include <cstring>
+
+LocalTimeCache::LocalTimeCache()
+    : m_cachedSecond(-1)
+    , m_cachedTime()
+    , m_cachedPrefix()
+    , m_cachedPrefixLength(0) {}
+
+// Refresh the cached calendar time when the second changes
+bool LocalTimeCache::update(std::time_t seconds) {
+    if (seconds == m_cachedSecond) {
+        return true;
+    }
+    if (localtime_r(&seconds, &m_cachedTime) == nullptr) {
+        return false;
+    }
+    m_cachedPrefixLength = std::strftime(m_cachedPrefix, sizeof(m_cachedPrefix), "%Y-%m-%d %H:%M:%S", &m_cachedTime);
+    m_cachedSecond = seconds;
+    return true;
+}
+
+const std::tm* LocalTimeCache::localTime(uint64_t timestampMs) {
+    if (!update(static_cast<std::time_t>(timestampMs / 1000))) {
+        return nullptr;
+    }
+    return &m_cachedTime;
+}
+
+size_t LocalTimeCache::format(uint64_t timestampMs, char* buffer, size_t size) {
+    if (!update(static_cast<std::time_t>(timestampMs / 1000)) || size < m_cachedPrefixLength + 5) {
+        return 0;
+    }
+
+    std::memcpy(buffer, m_cachedPrefix, m_cachedPrefixLength);
+    int written = std::snprintf(buffer + m_cachedPrefixLength, size - m_cachedPrefixLength, ".%03u",
+                                static_cast<unsigned int>(timestampMs % 1000));
+    return m_cachedPrefixLength + written;
+}
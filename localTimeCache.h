@@ -0,0 +1,32 @@
+#ifndef LOCAL_TIME_CACHE_H
+#define LOCAL_TIME_CACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+
+// Converts epoch-millisecond timestamps to local calendar time. The
+// localtime_r() result and the formatted `YYYY-MM-DD HH:MM:SS` prefix are
+// kept for the last second seen, so rows arriving within the same second
+// only cost a copy. Not thread-safe; give each thread its own instance.
+class LocalTimeCache {
+public:
+    LocalTimeCache();
+
+    // Local calendar time of the timestamp's second, valid until the next
+    // call; nullptr on failure
+    const std::tm* localTime(uint64_t timestampMs);
+
+    // Writes `YYYY-MM-DD HH:MM:SS.mmm`; returns the length, or 0 on failure
+    size_t format(uint64_t timestampMs, char* buffer, size_t size);
+
+private:
+    bool update(std::time_t seconds);
+
+    std::time_t m_cachedSecond;
+    std::tm m_cachedTime;
+    char m_cachedPrefix[24];
+    size_t m_cachedPrefixLength;
+};
+
+#endif // LOCAL_TIME_CACHE_H
@@ -0,0 +1,172 @@
+#include "logger.h"
+#include <cstdio>
+#include <cstring>
+#include "localTimeCache.h"
+
+namespace {
+// Lines the ring holds (a power of two); about 256 KiB
+constexpr size_t RING_CAPACITY = 1024;
+// How long the writer thread sleeps when the ring is empty
+constexpr auto WRITER_IDLE_SLEEP = std::chrono::milliseconds(20);
+
+const char* levelName(LogLevel level) {
+    switch (level) {
+        case LogLevel::Debug: return "DEBUG";
+        case LogLevel::Info: return "INFO";
+        case LogLevel::Warning: return "WARNING";
+        case LogLevel::Error: return "ERROR";
+    }
+    return "";
+}
+
+int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+}
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+    : m_ring(RING_CAPACITY)
+    , m_mask(RING_CAPACITY - 1)
+    , m_tail(0)
+    , m_head(0)
+    , m_written(0)
+    , m_dropped(0)
+    , m_level(LogLevel::Info)
+    , m_running(true) {
+    for (size_t i = 0; i < m_ring.size(); ++i) {
+        m_ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    m_thread = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger() {
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void Logger::write(LogLevel level, const char* text, size_t length) {
+    size_t position = m_tail.load(std::memory_order_relaxed);
+    Record* record;
+    while (true) {
+        record = &m_ring[position & m_mask];
+        size_t sequence = record->sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+        if (difference == 0) {
+            if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // The writer thread has not caught up; never wait for it
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            position = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    record->level = level;
+    record->length = static_cast<uint16_t>(length < MAX_LINE_LENGTH ? length : MAX_LINE_LENGTH);
+    record->timestampMs = static_cast<uint64_t>(nowMs());
+    std::memcpy(record->text, text, record->length);
+    record->sequence.store(position + 1, std::memory_order_release);
+}
+
+void Logger::flush() {
+    size_t target = m_tail.load(std::memory_order_acquire);
+    while (m_written.load(std::memory_order_acquire) < target && m_running.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+// Writer thread: take lines in order and write them, flushing once the ring is empty
+size_t Logger::drain() {
+    static LocalTimeCache timeCache;
+    char line[Logger::MAX_LINE_LENGTH + 64];
+    size_t count = 0;
+
+    while (true) {
+        Record& record = m_ring[m_head & m_mask];
+        if (record.sequence.load(std::memory_order_acquire) != m_head + 1) {
+            break;
+        }
+
+        size_t length = timeCache.format(record.timestampMs, line, sizeof(line));
+        length += std::snprintf(line + length, sizeof(line) - length, " %s ", levelName(record.level));
+        std::memcpy(line + length, record.text, record.length);
+        length += record.length;
+        line[length++] = '\n';
+        std::fwrite(line, 1, length, record.level >= LogLevel::Warning ? stderr : stdout);
+
+        record.sequence.store(m_head + m_ring.size(), std::memory_order_release);
+        ++m_head;
+        ++count;
+        m_written.store(m_head, std::memory_order_release);
+    }
+
+    if (count > 0) {
+        std::fflush(stdout);
+        std::fflush(stderr);
+    }
+    return count;
+}
+
+void Logger::run() {
+    uint64_t reportedDrops = 0;
+    while (true) {
+        bool stopping = !m_running.load();
+        size_t written = drain();
+
+        uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+        if (dropped != reportedDrops) {
+            std::fprintf(stderr, "Logger: %llu lines dropped, ring full\n",
+                         static_cast<unsigned long long>(dropped - reportedDrops));
+            reportedDrops = dropped;
+        }
+
+        if (stopping) {
+            break;
+        }
+        if (written == 0) {
+            std::this_thread::sleep_for(WRITER_IDLE_SLEEP);
+        }
+    }
+}
+
+LogLine::LogLine(LogLevel level)
+    : std::ostream(static_cast<std::streambuf*>(this))
+    , m_level(level) {
+    setp(m_buffer, m_buffer + sizeof(m_buffer));
+}
+
+LogLine::~LogLine() {
+    Logger::instance().write(m_level, m_buffer, static_cast<size_t>(pptr() - pbase()));
+}
+
+// The buffer is full; the rest of the line is dropped
+std::streambuf::int_type LogLine::overflow(std::streambuf::int_type) {
+    return std::streambuf::traits_type::eof();
+}
+
+LogRateLimit::LogRateLimit(std::chrono::seconds interval)
+    : m_intervalMs(std::chrono::duration_cast<std::chrono::milliseconds>(interval).count())
+    , m_nextMs(0)
+    , m_suppressed(0) {}
+
+bool LogRateLimit::allow(uint64_t& suppressed) {
+    int64_t now = nowMs();
+    int64_t next = m_nextMs.load(std::memory_order_relaxed);
+    if (now < next || !m_nextMs.compare_exchange_strong(next, now + m_intervalMs, std::memory_order_relaxed)) {
+        m_suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
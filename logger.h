@@ -0,0 +1,149 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+// Asynchronous logging. A statement formats its line into a stack buffer and
+// queues it in a lock-free ring; a background thread writes the lines out,
+// Debug and Info to stdout and Warning and Error to stderr. Callers never
+// wait on console or journal I/O; when the ring is full lines are dropped
+// and counted.
+//
+//   LOG_INFO("Inserted " << rows << " rows");
+//   LOG_ERROR_LIMITED("Unknown commandID 0x" << std::hex << id);   // at most once per 10 s here
+//
+// Statements below LOG_COMPILED_LEVEL are compiled out, arguments included.
+
+enum class LogLevel : uint8_t {
+    Debug = 0,
+    Info = 1,
+    Warning = 2,
+    Error = 3,
+};
+
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL 1    // Info
+#endif
+
+class Logger {
+public:
+    // Longest line kept; longer ones are truncated
+    static constexpr size_t MAX_LINE_LENGTH = 240;
+
+    static Logger& instance();
+
+    // Lines below level are skipped at run time
+    void setLevel(LogLevel level) { m_level.store(level, std::memory_order_relaxed); }
+    bool enabled(LogLevel level) const { return level >= m_level.load(std::memory_order_relaxed); }
+
+    // Queue one line; never blocks
+    void write(LogLevel level, const char* text, size_t length);
+    // Return once every line queued so far has been written
+    void flush();
+
+    ~Logger();
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+private:
+    // Slot of a bounded multi-producer queue (Vyukov): sequence tells
+    // producers and the consumer whose turn the slot is
+    struct Record {
+        std::atomic<size_t> sequence;
+        LogLevel level;
+        uint16_t length;
+        uint64_t timestampMs;
+        char text[MAX_LINE_LENGTH];
+    };
+
+    Logger();
+    void run();
+    size_t drain();
+
+    std::vector<Record> m_ring;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_tail;     ///< Next slot for a producer
+    alignas(64) size_t m_head;                  ///< Next slot for the writer thread
+    std::atomic<size_t> m_written;              ///< Lines taken by the writer thread
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<LogLevel> m_level;
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+};
+
+// Formats one line into a fixed buffer and queues it when destroyed
+class LogLine : private std::streambuf, public std::ostream {
+public:
+    explicit LogLine(LogLevel level);
+    ~LogLine();
+
+private:
+    std::streambuf::int_type overflow(std::streambuf::int_type c) override;
+
+    LogLevel m_level;
+    char m_buffer[Logger::MAX_LINE_LENGTH];
+};
+
+// Lets one line per interval through at a call site and counts the rest
+class LogRateLimit {
+public:
+    explicit LogRateLimit(std::chrono::seconds interval);
+
+    // True if a line may be written now; suppressed is how many were skipped before it
+    bool allow(uint64_t& suppressed);
+
+private:
+    int64_t m_intervalMs;
+    std::atomic<int64_t> m_nextMs;
+    std::atomic<uint64_t> m_suppressed;
+};
+
+#define LOG_AT(level, expr) \
+    do { \
+        if (Logger::instance().enabled(level)) { \
+            LogLine logLine(level); \
+            logLine << expr; \
+        } \
+    } while (0)
+
+// At most one line per 10 seconds from this statement, with a count of the ones skipped
+#define LOG_LIMITED_AT(level, expr) \
+    do { \
+        static LogRateLimit logRateLimit(std::chrono::seconds(10)); \
+        uint64_t logSuppressed = 0; \
+        if (Logger::instance().enabled(level) && logRateLimit.allow(logSuppressed)) { \
+            LogLine logLine(level); \
+            logLine << expr; \
+            if (logSuppressed > 0) { \
+                logLine << " (" << std::dec << logSuppressed << " more suppressed)"; \
+            } \
+        } \
+    } while (0)
+
+#define LOG_DISABLED(expr) do {} while (0)
+
+#if LOG_COMPILED_LEVEL <= 0
+#define LOG_DEBUG(expr) LOG_AT(LogLevel::Debug, expr)
+#else
+#define LOG_DEBUG(expr) LOG_DISABLED(expr)
+#endif
+
+#if LOG_COMPILED_LEVEL <= 1
+#define LOG_INFO(expr) LOG_AT(LogLevel::Info, expr)
+#else
+#define LOG_INFO(expr) LOG_DISABLED(expr)
+#endif
+
+#define LOG_WARNING(expr) LOG_AT(LogLevel::Warning, expr)
+#define LOG_ERROR(expr) LOG_AT(LogLevel::Error, expr)
+#define LOG_WARNING_LIMITED(expr) LOG_LIMITED_AT(LogLevel::Warning, expr)
+#define LOG_ERROR_LIMITED(expr) LOG_LIMITED_AT(LogLevel::Error, expr)
+
+#endif // LOGGER_H
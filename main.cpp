@@ -1,68 +1,112 @@
 #include <zmq.hpp>
 #include <msgpack.hpp>
-#include <iostream>
 #include <string>
+#include <vector>
 #include <unordered_map>
 #include <memory>
 #include <thread>
 #include <chrono>
 #include <ctime>
 #include <atomic>
+#include <algorithm>
 
 #include "receiver.h"
+#include "logger.h"
 #include "dataStorage.h"
 #include "storageManager.h"
+#include "retentionEngine.h"
+#include "recentCache.h"
+#include "queryServer.h"
+#include "deadbandFilter.h"
+#include "metricsExporter.h"
 
-// Function to wait until the start of the next hour
-void waitUntilNextHour() {
-    auto now = std::chrono::system_clock::now();
-    auto nextHour = std::chrono::time_point_cast<std::chrono::minutes>(now) + std::chrono::minutes(1);
-    std::this_thread::sleep_until(nextHour);
-}
+int main() {
+    // Create shared pointer for StorageManager
+    auto storageManager = std::make_shared<StorageManager>("localhost", "my_user", "my_password", "my_database");
+    // Use every core when partitions have to be archived
+    storageManager->setArchiveConcurrency(std::max(1u, std::thread::hardware_concurrency()));
+    // Retired partitions are kept as columnar archives; read them back with luxarchive
+    storageManager->setArchiveFormat(ArchiveFormat::Columnar);
+    // Read partitions for archiving in chunks of about 20k rows at no more
+    // than 4 MiB/s, slowing down further whenever rows wait over 100 ms for a writer
+    ExportOptions exportOptions;
+    exportOptions.chunkRows = 20000;
+    exportOptions.throttle = std::make_shared<ExportThrottle>(4 * 1024 * 1024, std::chrono::milliseconds(100));
+    storageManager->setExportOptions(exportOptions);
+
+    // Specify the folder where CSV files should be exported
+    std::string outputFolder = "/home/raspberry/database";
 
-// Thread function to check disk usage
-void monitorDiskUsage(std::shared_ptr<StorageManager> storageManager, std::atomic<bool>& running, const std::string& outputFolder) {
-    while (running) {
-        // Wait until the next hour
-        waitUntilNextHour();
+    // Capture a row every 8 messages and write rows in batches of 64 rows or
+    // 64 KiB, but never hold data back for more than 250 ms at either step.
+    // Rows the database cannot take are spooled next to the archives and replayed later.
+    FlushPolicy flushPolicy;
+    flushPolicy.maxLatency = std::chrono::milliseconds(250);
+    flushPolicy.maxRows = 64;
+    flushPolicy.maxBytes = 64 * 1024;
+    flushPolicy.messagesPerRow = 8;
 
-        // Check disk usage
-        if (storageManager->checkDiskUsage()) {
-            std::cout << "Disk usage is full!" << std::endl;
-            // Trigger storage reduction by calling reduceStorage
-            storageManager->reduceStorage(outputFolder);  // For example, delete data older than 30 days
-        }
-        else {
-            std::cout << "Disk usage is below threshold." << std::endl;
+    // Devices are spread over one writer thread per core, each with its own connection
+    size_t writerThreads = std::max(1u, std::thread::hardware_concurrency());
+    auto storage = std::make_shared<DataStorage>(flushPolicy, 4096, DbConfig(), outputFolder + "/laser_data.spool",
+                                                 writerThreads);
+
+    // Serve the last 10 minutes (up to 64k rows) from memory on a local socket
+    auto recentCache = std::make_shared<RecentCache>(64 * 1024, std::chrono::minutes(10));
+    storage->setRecentCache(recentCache);
+    QueryServer queryServer(recentCache, "tcp://127.0.0.1:5556");
+
+    // Change-driven storage: only store rows where a field moved past its
+    // deadband, plus a heartbeat row at least once a minute
+    const bool changeDrivenStorage = false;
+    if (changeDrivenStorage) {
+        auto deadband = std::make_unique<DeadbandFilter>(std::chrono::minutes(1));
+        // A misspelled or non-numeric field would silently go without a deadband
+        auto setDeadband = [&deadband](const char* field, DeadbandType type, double width) {
+            if (!deadband->setDeadband(field, type, width)) {
+                LOG_ERROR("No numeric field " << field << " to give a deadband, not starting");
+                return false;
+            }
+            return true;
+        };
+        if (!setDeadband("powerReading", DeadbandType::Percent, 1.0) ||
+            !setDeadband("tubePressure", DeadbandType::Absolute, 2.0)) {
+            Logger::instance().flush();
+            return 1;
         }
+        storage->setDeadbandFilter(std::move(deadband));
     }
-}
 
+    // Stage latencies, throughput and writer queue depth for node_exporter's textfile collector
+    MetricsExporter metricsExporter(outputFolder + "/luxreceiver.prom", std::chrono::seconds(15), {
+        {"lux_writer_queue_depth", "Rows waiting in the writer queues",
+         [storage] { return static_cast<uint64_t>(storage->queueStats().depth); }},
+        {"lux_writer_queue_capacity", "Rows the writer queues can hold",
+         [storage] { return static_cast<uint64_t>(storage->queueStats().capacity); }},
+        {"lux_writer_queue_high_water", "Deepest any writer queue has been",
+         [storage] { return static_cast<uint64_t>(storage->queueStats().highWaterMark); }},
+    });
 
-int main() {
-    // Create shared pointer for StorageManager
-    auto storageManager = std::make_shared<StorageManager>("localhost", "my_user", "my_password", "my_database");
-    auto storage = std::make_shared<DataStorage>();
+    // Retire the oldest day partitions to the archive folder ahead of the storage limit in settings
+    RetentionEngine retention(DbConfig(), "laser_data", storageManager, outputFolder);
 
-    // Atomic flag to manage the lifetime of the thread
-    std::atomic<bool> running(true);
+    // Publishers to subscribe to, one per laser
+    std::vector<std::string> endpoints = {"tcp://127.0.0.1:5555"};
 
-    // Specify the folder where CSV files should be exported
-    std::string outputFolder = "/home/raspberry/database";
-
-    // Start the disk usage monitor thread
-    std::thread diskMonitorThread(monitorDiskUsage, storageManager, std::ref(running), outputFolder);
+    // Queue up to 10k messages and 4 MiB of socket buffer per publisher, enough
+    // to ride out a stall of a few seconds at full rate without dropping any
+    ReceiveOptions receiveOptions;
+    receiveOptions.receiveHwm = 10000;
+    receiveOptions.receiveBufferBytes = 4 * 1024 * 1024;
+    // Messages are unpacked on the receive thread; with many busy publishers,
+    // set this to spread unpacking over more cores
+    receiveOptions.decodeWorkers = 0;
 
     // Create receiver with shared resources
-    Receiver receiver(storage);
+    Receiver receiver(storage, endpoints, receiveOptions);
     receiver.receiveData();
 
-    // Join the thread (optional if you need clean termination, or handle stopping it)
-    running = false;
-    if (diskMonitorThread.joinable()) {
-        diskMonitorThread.join();
-    }
-
+    Logger::instance().flush();
     return 0;
 }
 
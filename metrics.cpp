@@ -0,0 +1,94 @@
+#include "metrics.h"
+#include <algorithm>
+
+LatencyHistogram::Window LatencyHistogram::takeWindow(std::vector<uint64_t>& previous) {
+    previous.resize(BUCKET_COUNT, 0);
+
+    // Counts recorded since the last window, per bucket
+    std::vector<uint64_t> counts(BUCKET_COUNT);
+    uint64_t total = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        uint64_t current = m_buckets[i].load(std::memory_order_relaxed);
+        counts[i] = current - previous[i];
+        previous[i] = current;
+        total += counts[i];
+    }
+
+    Window window;
+    window.count = m_count.load(std::memory_order_relaxed);
+    window.sumNs = m_sumNs.load(std::memory_order_relaxed);
+    window.maxNs = m_maxNs.exchange(0, std::memory_order_relaxed);
+    window.p50Ns = 0;
+    window.p99Ns = 0;
+    if (total == 0) {
+        return window;
+    }
+
+    // Report a bucket's upper bound, but never more than the exact maximum. A
+    // value recorded while the window closes may be counted without its maximum.
+    uint64_t limit = window.maxNs > 0 ? window.maxNs : UINT64_MAX;
+    uint64_t p50Rank = (total + 1) / 2;
+    uint64_t p99Rank = total - total / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        uint64_t before = seen;
+        seen += counts[i];
+        if (before < p50Rank && seen >= p50Rank) {
+            window.p50Ns = std::min(bucketUpperBound(i), limit);
+        }
+        if (before < p99Rank && seen >= p99Rank) {
+            window.p99Ns = std::min(bucketUpperBound(i), limit);
+            break;
+        }
+    }
+    return window;
+}
+
+uint64_t LatencyHistogram::quantileSince(std::vector<uint64_t>& previous, double quantile) const {
+    previous.resize(BUCKET_COUNT, 0);
+
+    std::vector<uint64_t> counts(BUCKET_COUNT);
+    uint64_t total = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        uint64_t current = m_buckets[i].load(std::memory_order_relaxed);
+        counts[i] = current - previous[i];
+        previous[i] = current;
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(quantile * total + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return bucketUpperBound(i);
+        }
+    }
+    return bucketUpperBound(BUCKET_COUNT - 1);
+}
+
+PublisherMetrics& PipelineMetrics::addPublisher(const std::string& address) {
+    std::lock_guard<std::mutex> lock(m_publishersMutex);
+    m_publishers.push_back(std::make_unique<PublisherMetrics>(address));
+    return *m_publishers.back();
+}
+
+std::vector<const PublisherMetrics*> PipelineMetrics::publisherList() {
+    std::lock_guard<std::mutex> lock(m_publishersMutex);
+    std::vector<const PublisherMetrics*> publishers;
+    for (const auto& publisher : m_publishers) {
+        publishers.push_back(publisher.get());
+    }
+    return publishers;
+}
+
+PipelineMetrics& pipelineMetrics() {
+    static PipelineMetrics metrics;
+    return metrics;
+}
@@ -0,0 +1,180 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "telemetrySchema.h"
+
+// Counters and latency histograms for every pipeline stage. Recording is a
+// few relaxed atomic adds and never blocks; MetricsExporter reads them from
+// its own thread.
+
+class MetricCounter {
+public:
+    void add(uint64_t count = 1) { m_value.fetch_add(count, std::memory_order_relaxed); }
+    uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_value{0};
+};
+
+// Log-linear buckets in the style of HdrHistogram: 16 sub-buckets per power
+// of two, so a recorded duration is known to within 1/16. Covers 1 ns to
+// about 2.4 hours; anything longer lands in the last bucket.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+    static constexpr int MAX_EXPONENT = 42;
+    static constexpr size_t BUCKET_COUNT = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+    // Counts since the start, quantiles and max since the previous window
+    struct Window {
+        uint64_t count;
+        uint64_t sumNs;
+        uint64_t p50Ns;
+        uint64_t p99Ns;
+        uint64_t maxNs;
+    };
+
+    void record(std::chrono::nanoseconds elapsed) {
+        uint64_t value = elapsed.count() > 0 ? static_cast<uint64_t>(elapsed.count()) : 0;
+        m_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sumNs.fetch_add(value, std::memory_order_relaxed);
+        uint64_t max = m_maxNs.load(std::memory_order_relaxed);
+        while (value > max && !m_maxNs.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Close the current window. previous holds the bucket counts of the last
+    // call and is updated; only one thread may take windows.
+    Window takeWindow(std::vector<uint64_t>& previous);
+
+    // Upper bound of quantile (0 to 1) of the values recorded since the last
+    // call with the same previous, or 0 if there were none. Unlike
+    // takeWindow() it leaves the maximum alone, so other threads may use it.
+    uint64_t quantileSince(std::vector<uint64_t>& previous, double quantile) const;
+
+    static size_t bucketIndex(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        if (exponent > MAX_EXPONENT) {
+            return BUCKET_COUNT - 1;
+        }
+        size_t sub = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+        return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    // Largest value that falls into the bucket
+    static uint64_t bucketUpperBound(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        size_t exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        uint64_t sub = index % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (exponent - SUB_BUCKET_BITS)) - 1;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> m_buckets{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sumNs{0};
+    std::atomic<uint64_t> m_maxNs{0};
+};
+
+// Records the time from construction to destruction
+class StageTimer {
+public:
+    explicit StageTimer(LatencyHistogram& histogram)
+        : m_histogram(histogram)
+        , m_start(std::chrono::steady_clock::now()) {}
+    ~StageTimer() { m_histogram.record(std::chrono::steady_clock::now() - m_start); }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    LatencyHistogram& m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Number of entries in TELEMETRY_MESSAGES
+constexpr size_t TELEMETRY_MESSAGE_COUNT = 0
+#define METRICS_COUNT_MESSAGE(command) + 1
+    TELEMETRY_MESSAGES(METRICS_COUNT_MESSAGE);
+#undef METRICS_COUNT_MESSAGE
+
+// Receive counters for one publisher, from the sequence numbers it stamps on its messages
+struct PublisherMetrics {
+    explicit PublisherMetrics(const std::string& endpoint)
+        : address(endpoint) {}
+
+    const std::string address;
+    MetricCounter messages;
+    MetricCounter lost;             ///< Sequence numbers skipped
+    MetricCounter restarts;         ///< Sequence went backwards, as when the publisher restarts
+};
+
+struct PipelineMetrics {
+    // Receive thread
+    LatencyHistogram receive;       ///< One ZMQ recv
+    LatencyHistogram decode;        ///< msgpack unpack of one message
+    // handleMessage(), indexed like TELEMETRY_MESSAGES with unknown commandIDs last
+    LatencyHistogram dispatch[TELEMETRY_MESSAGE_COUNT + 1];
+    MetricCounter messages;
+    MetricCounter messagesLost;     ///< Sequence gaps summed over every publisher
+    MetricCounter decodeErrors;
+    MetricCounter rowsCaptured;
+    MetricCounter rowsSuppressed;   ///< Skipped by the deadband filter
+    MetricCounter rowsDropped;      ///< Writer queue full
+
+    // Writer threads
+    LatencyHistogram queueWait;     ///< From capture until a writer thread takes the row
+    LatencyHistogram insert;        ///< One batch INSERT and commit
+    MetricCounter rowsInserted;
+    MetricCounter rowsSpooled;
+    MetricCounter insertFailures;
+
+    // Background work
+    LatencyHistogram partitionMaintenance;  ///< One run of a PartitionMaintainer
+    LatencyHistogram exportPartition;       ///< Reading one partition out of the database
+    LatencyHistogram compressBlock;         ///< Compressing or encoding one archive block
+    MetricCounter archivedBytes;
+    MetricCounter rollupBucketsDropped;     ///< Rollup buckets never written
+
+    LatencyHistogram& dispatchFor(uint16_t commandID) {
+        size_t index = 0;
+#define METRICS_DISPATCH_INDEX(command) \
+        if (commandID == command) { \
+            return dispatch[index]; \
+        } \
+        ++index;
+        TELEMETRY_MESSAGES(METRICS_DISPATCH_INDEX)
+#undef METRICS_DISPATCH_INDEX
+        return dispatch[TELEMETRY_MESSAGE_COUNT];
+    }
+
+    // Counters for a newly subscribed publisher; they live as long as the process
+    PublisherMetrics& addPublisher(const std::string& address);
+    // Every publisher added so far
+    std::vector<const PublisherMetrics*> publisherList();
+
+private:
+    std::mutex m_publishersMutex;
+    std::vector<std::unique_ptr<PublisherMetrics>> m_publishers;
+};
+
+// Shared by every component of the process
+PipelineMetrics& pipelineMetrics();
+
+#endif // METRICS_H
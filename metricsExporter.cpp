@@ -0,0 +1,157 @@
+#include "metricsExporter.h"
+#include "logger.h"
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <utility>
+
+namespace {
+double seconds(uint64_t nanoseconds) {
+    return nanoseconds / 1e9;
+}
+}
+
+MetricsExporter::MetricsExporter(const std::string& path, std::chrono::seconds interval, std::vector<Gauge> gauges)
+    : m_path(path)
+    , m_interval(interval)
+    , m_gauges(std::move(gauges))
+    , m_lastMessages(0)
+    , m_lastRowsInserted(0)
+    , m_stopping(false) {
+    PipelineMetrics& metrics = pipelineMetrics();
+    m_stages.push_back(Stage{"stage=\"receive\"", &metrics.receive, {}});
+    m_stages.push_back(Stage{"stage=\"decode\"", &metrics.decode, {}});
+    size_t index = 0;
+#define METRICS_DISPATCH_STAGE(command) \
+    m_stages.push_back(Stage{"stage=\"dispatch\",command=\"" #command "\"", &metrics.dispatch[index++], {}});
+    TELEMETRY_MESSAGES(METRICS_DISPATCH_STAGE)
+#undef METRICS_DISPATCH_STAGE
+    m_stages.push_back(Stage{"stage=\"dispatch\",command=\"unknown\"", &metrics.dispatch[index], {}});
+    m_stages.push_back(Stage{"stage=\"queue\"", &metrics.queueWait, {}});
+    m_stages.push_back(Stage{"stage=\"insert\"", &metrics.insert, {}});
+    m_stages.push_back(Stage{"stage=\"partition_maintenance\"", &metrics.partitionMaintenance, {}});
+    m_stages.push_back(Stage{"stage=\"export\"", &metrics.exportPartition, {}});
+    m_stages.push_back(Stage{"stage=\"compress\"", &metrics.compressBlock, {}});
+
+    m_thread = std::thread(&MetricsExporter::run, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void MetricsExporter::run() {
+    auto last = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_wake.wait_for(lock, m_interval, [this] { return m_stopping; })) {
+        lock.unlock();
+        auto now = std::chrono::steady_clock::now();
+        exportOnce(now - last);
+        last = now;
+        lock.lock();
+    }
+}
+
+void MetricsExporter::exportOnce(std::chrono::steady_clock::duration elapsed) {
+    PipelineMetrics& metrics = pipelineMetrics();
+    double elapsedSeconds = std::chrono::duration<double>(elapsed).count();
+    std::ostringstream out;
+
+    std::vector<LatencyHistogram::Window> windows;
+    for (auto& stage : m_stages) {
+        windows.push_back(stage.histogram->takeWindow(stage.previous));
+    }
+
+    out << "# HELP lux_stage_seconds Time spent in each pipeline stage\n"
+        << "# TYPE lux_stage_seconds summary\n";
+    for (size_t i = 0; i < m_stages.size(); ++i) {
+        const std::string& labels = m_stages[i].labels;
+        out << "lux_stage_seconds{" << labels << ",quantile=\"0.5\"} " << seconds(windows[i].p50Ns) << "\n"
+            << "lux_stage_seconds{" << labels << ",quantile=\"0.99\"} " << seconds(windows[i].p99Ns) << "\n"
+            << "lux_stage_seconds_sum{" << labels << "} " << seconds(windows[i].sumNs) << "\n"
+            << "lux_stage_seconds_count{" << labels << "} " << windows[i].count << "\n";
+    }
+    out << "# HELP lux_stage_max_seconds Longest time in each pipeline stage during the last interval\n"
+        << "# TYPE lux_stage_max_seconds gauge\n";
+    for (size_t i = 0; i < m_stages.size(); ++i) {
+        out << "lux_stage_max_seconds{" << m_stages[i].labels << "} " << seconds(windows[i].maxNs) << "\n";
+    }
+
+    auto counter = [&out](const char* name, const char* help, uint64_t value) {
+        out << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " counter\n"
+            << name << " " << value << "\n";
+    };
+    counter("lux_messages_total", "Messages received", metrics.messages.value());
+    counter("lux_messages_lost_total", "Messages missing from publisher sequence numbers",
+            metrics.messagesLost.value());
+    counter("lux_decode_errors_total", "Messages that could not be unpacked", metrics.decodeErrors.value());
+    counter("lux_rows_captured_total", "Rows captured from device state", metrics.rowsCaptured.value());
+    counter("lux_rows_suppressed_total", "Rows skipped by the deadband filter", metrics.rowsSuppressed.value());
+    counter("lux_rows_dropped_total", "Rows dropped because a writer queue was full", metrics.rowsDropped.value());
+    counter("lux_rows_inserted_total", "Rows written to the database", metrics.rowsInserted.value());
+    counter("lux_rows_spooled_total", "Rows written to a spool instead of the database", metrics.rowsSpooled.value());
+    counter("lux_insert_failures_total", "Batch inserts that failed", metrics.insertFailures.value());
+    counter("lux_archived_bytes_total", "Bytes written to archives", metrics.archivedBytes.value());
+    counter("lux_rollup_buckets_dropped_total", "Rollup buckets dropped without being written",
+            metrics.rollupBucketsDropped.value());
+
+    for (const auto& gauge : m_gauges) {
+        out << "# HELP " << gauge.name << " " << gauge.help << "\n"
+            << "# TYPE " << gauge.name << " gauge\n"
+            << gauge.name << " " << gauge.value() << "\n";
+    }
+
+    // Per publisher, labelled by endpoint; only publishers that send sequence numbers count
+    std::vector<const PublisherMetrics*> publishers = metrics.publisherList();
+    auto publisherCounter = [&out, &publishers](const char* name, const char* help,
+                                                const MetricCounter PublisherMetrics::*member) {
+        out << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " counter\n";
+        for (const PublisherMetrics* publisher : publishers) {
+            out << name << "{publisher=\"" << publisher->address << "\"} " << (publisher->*member).value() << "\n";
+        }
+    };
+    if (!publishers.empty()) {
+        publisherCounter("lux_publisher_messages_total", "Sequenced messages received from each publisher",
+                         &PublisherMetrics::messages);
+        publisherCounter("lux_publisher_lost_total", "Messages missing from each publisher's sequence",
+                         &PublisherMetrics::lost);
+        publisherCounter("lux_publisher_restarts_total", "Times a publisher's sequence started over",
+                         &PublisherMetrics::restarts);
+    }
+
+    uint64_t messages = metrics.messages.value();
+    uint64_t rowsInserted = metrics.rowsInserted.value();
+    if (elapsedSeconds > 0) {
+        out << "# HELP lux_messages_per_second Messages received per second during the last interval\n"
+            << "# TYPE lux_messages_per_second gauge\n"
+            << "lux_messages_per_second " << (messages - m_lastMessages) / elapsedSeconds << "\n"
+            << "# HELP lux_rows_per_second Rows written per second during the last interval\n"
+            << "# TYPE lux_rows_per_second gauge\n"
+            << "lux_rows_per_second " << (rowsInserted - m_lastRowsInserted) / elapsedSeconds << "\n";
+    }
+    m_lastMessages = messages;
+    m_lastRowsInserted = rowsInserted;
+
+    // Write next to the target and rename, so a scrape never sees half a file
+    std::string tempPath = m_path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::trunc);
+        file << out.str();
+        if (!file) {
+            LOG_ERROR("Failed to write metrics to " << tempPath);
+            return;
+        }
+    }
+    if (std::rename(tempPath.c_str(), m_path.c_str()) != 0) {
+        LOG_ERROR("Failed to replace metrics file " << m_path);
+    }
+}
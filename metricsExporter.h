@@ -0,0 +1,55 @@
+#ifndef METRICS_EXPORTER_H
+#define METRICS_EXPORTER_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "metrics.h"
+
+// Writes pipelineMetrics() to a Prometheus text file every interval, e.g.
+// for node_exporter's textfile collector. The file is replaced atomically.
+// Quantiles, maxima and rates cover the last interval; counts and sums run
+// from process start.
+class MetricsExporter {
+public:
+    // A value owned elsewhere, read on the exporter thread at every export
+    struct Gauge {
+        std::string name;
+        std::string help;
+        std::function<uint64_t()> value;
+    };
+
+    MetricsExporter(const std::string& path, std::chrono::seconds interval, std::vector<Gauge> gauges = {});
+    ~MetricsExporter();
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+private:
+    struct Stage {
+        std::string labels;             ///< e.g. stage="decode"
+        LatencyHistogram* histogram;
+        std::vector<uint64_t> previous; ///< Bucket counts at the last export
+    };
+
+    void run();
+    void exportOnce(std::chrono::steady_clock::duration elapsed);
+
+    std::string m_path;
+    std::chrono::seconds m_interval;
+    std::vector<Stage> m_stages;
+    std::vector<Gauge> m_gauges;
+    uint64_t m_lastMessages;
+    uint64_t m_lastRowsInserted;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping;
+};
+
+#endif // METRICS_EXPORTER_H
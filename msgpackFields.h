@@ -0,0 +1,71 @@
+#ifndef MSGPACK_FIELDS_H
+#define MSGPACK_FIELDS_H
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <msgpack.hpp>
+
+// Helpers for reading fields straight out of an unpacked msgpack map without
+// building an intermediate container. None of them allocate or throw.
+
+// Compare a msgpack string key with a NUL-terminated name
+inline bool keyEquals(const msgpack::object& key, const char* name) {
+    if (key.type != msgpack::type::STR) {
+        return false;
+    }
+    size_t length = std::strlen(name);
+    return key.via.str.size == length && std::memcmp(key.via.str.ptr, name, length) == 0;
+}
+
+// Linear search of a map for a key; maps here hold only a handful of entries
+inline const msgpack::object* findField(const msgpack::object_map& fields, const char* name) {
+    for (uint32_t i = 0; i < fields.size; ++i) {
+        if (keyEquals(fields.ptr[i].key, name)) {
+            return &fields.ptr[i].val;
+        }
+    }
+    return nullptr;
+}
+
+inline bool readUint(const msgpack::object& value, uint64_t& out) {
+    if (value.type != msgpack::type::POSITIVE_INTEGER) {
+        return false;
+    }
+    out = value.via.u64;
+    return true;
+}
+
+inline bool readUint(const msgpack::object& value, uint32_t& out) {
+    if (value.type != msgpack::type::POSITIVE_INTEGER || value.via.u64 > std::numeric_limits<uint32_t>::max()) {
+        return false;
+    }
+    out = static_cast<uint32_t>(value.via.u64);
+    return true;
+}
+
+inline bool readUint(const msgpack::object& value, uint16_t& out) {
+    if (value.type != msgpack::type::POSITIVE_INTEGER || value.via.u64 > std::numeric_limits<uint16_t>::max()) {
+        return false;
+    }
+    out = static_cast<uint16_t>(value.via.u64);
+    return true;
+}
+
+// unpack_reference_func that lets unpacked strings point into the buffer
+// being unpacked instead of copying them into the zone
+inline bool referenceBuffer(msgpack::type::object_type, std::size_t, void*) {
+    return true;
+}
+
+// Assigning into an existing string reuses its capacity
+inline bool readString(const msgpack::object& value, std::string& out) {
+    if (value.type != msgpack::type::STR) {
+        return false;
+    }
+    out.assign(value.via.str.ptr, value.via.str.size);
+    return true;
+}
+
+#endif // MSGPACK_FIELDS_H
@@ -0,0 +1,296 @@
+#include "partitionMaintainer.h"
+#include "logger.h"
+#include "metrics.h"
+#include <sstream>
+#include <chrono>
+#include <cctype>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+// Run this long after local midnight so the new day is safely under way
+constexpr auto MIDNIGHT_DELAY = std::chrono::minutes(5);
+// Retry interval after a failed run
+constexpr auto RETRY_INTERVAL = std::chrono::minutes(5);
+
+// Time point a few minutes after the coming local midnight
+std::chrono::system_clock::time_point nextMidnight() {
+    std::time_t now = std::time(nullptr);
+    std::tm localTime;
+    localtime_r(&now, &localTime);
+    localTime.tm_mday += 1;
+    localTime.tm_hour = 0;
+    localTime.tm_min = 0;
+    localTime.tm_sec = 0;
+    localTime.tm_isdst = -1;
+    return std::chrono::system_clock::from_time_t(std::mktime(&localTime)) + MIDNIGHT_DELAY;
+}
+
+// Local midnight at the end of the day holding time
+std::time_t midnightAfter(std::time_t time) {
+    std::tm localTime;
+    localtime_r(&time, &localTime);
+    localTime.tm_mday += 1;
+    localTime.tm_hour = 0;
+    localTime.tm_min = 0;
+    localTime.tm_sec = 0;
+    localTime.tm_isdst = -1;
+    return std::mktime(&localTime);
+}
+
+// "PARTITION PYYYYMMDD VALUES LESS THAN ('YYYY-MM-DD 00:00:00')" for the partition ending at midnight
+std::string partitionDefinition(std::time_t midnight) {
+    std::tm localTime;
+    localtime_r(&midnight, &localTime);
+    char definition[80];
+    std::strftime(definition, sizeof(definition),
+                  "PARTITION P%Y%m%d VALUES LESS THAN ('%Y-%m-%d 00:00:00')", &localTime);
+    return definition;
+}
+
+// Every day partition of the table, by date
+bool readPartitions(MYSQL* conn, const std::string& tableName, std::map<std::time_t, std::string>& partitions) {
+    std::string query =
+        "SELECT partition_name FROM information_schema.partitions "
+        "WHERE table_schema = DATABASE() AND table_name = '" + tableName + "' "
+        "AND partition_name IS NOT NULL";
+    if (mysql_query(conn, query.c_str())) {
+        LOG_ERROR("Failed to check partitions: " << mysql_error(conn));
+        return false;
+    }
+    MYSQL_RES* result = mysql_store_result(conn);
+    if (!result) {
+        LOG_ERROR("Failed to retrieve partitions: " << mysql_error(conn));
+        return false;
+    }
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result))) {
+        std::time_t date;
+        if (row[0] && parsePartitionDate(row[0], date)) {
+            partitions[date] = row[0];
+        }
+    }
+    mysql_free_result(result);
+    return true;
+}
+
+} // namespace
+
+bool parsePartitionDate(const std::string& name, std::time_t& date) {
+    if (name.size() != 9 || (name[0] != 'p' && name[0] != 'P')) {
+        return false;
+    }
+    for (size_t i = 1; i < name.size(); ++i) {
+        if (!std::isdigit(static_cast<unsigned char>(name[i]))) {
+            return false;
+        }
+    }
+
+    std::tm partitionTime = {};
+    partitionTime.tm_year = std::stoi(name.substr(1, 4)) - 1900;
+    partitionTime.tm_mon = std::stoi(name.substr(5, 2)) - 1;
+    partitionTime.tm_mday = std::stoi(name.substr(7, 2));
+    partitionTime.tm_isdst = -1;
+    date = std::mktime(&partitionTime);
+    return date != -1;
+}
+
+bool createDayPartitions(MYSQL* conn, const std::string& tableName, std::time_t firstRow, std::time_t lastRow) {
+    std::map<std::time_t, std::string> existing;
+    if (!readPartitions(conn, tableName, existing)) {
+        return false;
+    }
+
+    // Missing partitions, grouped by the existing partition they are split
+    // off; those past the latest partition are added instead
+    std::map<std::time_t, std::vector<std::time_t>> splits;
+    std::vector<std::time_t> additions;
+    std::time_t last = midnightAfter(lastRow);
+    for (std::time_t midnight = midnightAfter(firstRow); midnight <= last; midnight = midnightAfter(midnight)) {
+        if (existing.count(midnight)) {
+            continue;
+        }
+        auto holder = existing.upper_bound(midnight);
+        if (holder == existing.end()) {
+            additions.push_back(midnight);
+        } else {
+            splits[holder->first].push_back(midnight);
+        }
+    }
+
+    // REORGANIZE PARTITION copies the rows of the partition it splits while
+    // writes to the table wait, so only empty partitions are split
+    for (const auto& split : splits) {
+        const std::string& holder = existing[split.first];
+        std::string probe = "SELECT 1 FROM " + tableName + " PARTITION (" + holder + ") LIMIT 1";
+        if (mysql_query(conn, probe.c_str())) {
+            LOG_ERROR("Failed to check partition " << holder << ": " << mysql_error(conn));
+            return false;
+        }
+        MYSQL_RES* result = mysql_store_result(conn);
+        bool occupied = result == NULL || mysql_num_rows(result) > 0;
+        if (result != NULL) {
+            mysql_free_result(result);
+        }
+        if (occupied) {
+            LOG_ERROR("Partition " << holder << " holds rows; not splitting " << split.second.size()
+                      << " day partitions off it");
+            return false;
+        }
+    }
+
+    for (const auto& split : splits) {
+        std::stringstream query;
+        query << "ALTER TABLE " << tableName << " REORGANIZE PARTITION " << existing[split.first] << " INTO (";
+        for (std::time_t midnight : split.second) {
+            query << partitionDefinition(midnight) << ", ";
+        }
+        query << partitionDefinition(split.first) << ")";
+        LOG_INFO("Splitting " << split.second.size() << " day partitions off " << existing[split.first]);
+        if (mysql_query(conn, query.str().c_str())) {
+            LOG_ERROR("Failed to reorganize partition " << existing[split.first] << ": " << mysql_error(conn));
+            return false;
+        }
+    }
+
+    if (!additions.empty()) {
+        std::stringstream query;
+        query << "ALTER TABLE " << tableName << " ADD PARTITION (";
+        for (size_t i = 0; i < additions.size(); ++i) {
+            query << (i > 0 ? ", " : "") << partitionDefinition(additions[i]);
+        }
+        query << ")";
+        if (mysql_query(conn, query.str().c_str())) {
+            LOG_ERROR("Failed to add partitions: " << mysql_error(conn));
+            return false;
+        }
+        LOG_INFO("Added " << additions.size() << " day partitions");
+    }
+    return true;
+}
+
+PartitionMaintainer::PartitionMaintainer(const DbConfig& dbConfig, const std::string& tableName, int daysAhead,
+                                         HorizonCallback onHorizon)
+    : m_dbConfig(dbConfig)
+    , m_tableName(tableName)
+    , m_daysAhead(daysAhead)
+    , m_onHorizon(std::move(onHorizon))
+    , m_conn(NULL)
+    , m_runRequested(true)
+    , m_stopping(false) {
+    m_thread = std::thread(&PartitionMaintainer::run, this);
+}
+
+PartitionMaintainer::~PartitionMaintainer() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if (m_conn != NULL) {
+        mysql_close(m_conn);
+    }
+}
+
+void PartitionMaintainer::requestRun() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_runRequested = true;
+    }
+    m_wake.notify_one();
+}
+
+// Maintenance thread: run now, then after every midnight or on request
+void PartitionMaintainer::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping) {
+        m_runRequested = false;
+        lock.unlock();
+        bool succeeded;
+        {
+            StageTimer timer(pipelineMetrics().partitionMaintenance);
+            succeeded = ensurePartitions();
+        }
+        lock.lock();
+
+        auto wakeAt = succeeded ? nextMidnight() : std::chrono::system_clock::now() + RETRY_INTERVAL;
+        m_wake.wait_until(lock, wakeAt, [this] { return m_stopping || m_runRequested; });
+    }
+}
+
+// Create the partitions for today and the next m_daysAhead days that do not exist yet
+bool PartitionMaintainer::ensurePartitions() {
+    if (m_conn == NULL) {
+        m_conn = openConnection(m_dbConfig);
+        if (m_conn == NULL) {
+            return false;
+        }
+    }
+
+    std::map<std::time_t, std::string> existing;
+    if (!readPartitions(m_conn, m_tableName, existing)) {
+        mysql_close(m_conn);
+        m_conn = NULL;
+        return false;
+    }
+
+    // Partitions are range partitions in date order, so only days after the
+    // latest existing one can be added
+    std::time_t latestPartition = existing.empty() ? 0 : existing.rbegin()->first;
+
+    std::time_t now = std::time(nullptr);
+    std::tm currentTime;
+    localtime_r(&now, &currentTime);
+
+    // Prepare partition creation query
+    std::stringstream partitionQuery;
+    partitionQuery << "ALTER TABLE " << m_tableName << " ADD PARTITION (";
+
+    bool partitionNeedsAdding = false;
+    std::time_t horizon = latestPartition;
+
+    for (int offset = 0; offset <= m_daysAhead; ++offset) {
+        // Construct partition time; mktime normalises days past the end of the month
+        std::tm partitionTime = currentTime;
+        partitionTime.tm_mday += offset;
+        partitionTime.tm_hour = 0;
+        partitionTime.tm_min = 0;
+        partitionTime.tm_sec = 0;
+        partitionTime.tm_isdst = -1;
+        std::time_t partitionDate = std::mktime(&partitionTime);
+
+        if (partitionDate <= latestPartition) {
+            continue;
+        }
+
+        if (partitionNeedsAdding) {
+            partitionQuery << ", ";
+        }
+        partitionQuery << partitionDefinition(partitionDate);
+
+        partitionNeedsAdding = true;
+        horizon = partitionDate;
+    }
+
+    partitionQuery << ");";
+
+    if (partitionNeedsAdding) {
+        std::string queryStr = partitionQuery.str();
+        LOG_DEBUG("Generated Query: " << queryStr);
+
+        if (mysql_query(m_conn, queryStr.c_str())) {
+            LOG_ERROR("Failed to add partitions: " << mysql_error(m_conn));
+            return false;
+        }
+        LOG_INFO("Partitions added successfully.");
+    }
+
+    if (m_onHorizon) {
+        m_onHorizon(horizon);
+    }
+    return true;
+}
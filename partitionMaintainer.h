@@ -0,0 +1,61 @@
+#ifndef PARTITION_MAINTAINER_H
+#define PARTITION_MAINTAINER_H
+
+#include <string>
+#include <ctime>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mariadb/mysql.h>
+#include "dbConnection.h"
+
+// Parse a partition name of the form pYYYYMMDD (either case) into local
+// midnight of that day. Partition pYYYYMMDD holds the rows before that
+// midnight, so its date is the day after the data in it.
+bool parsePartitionDate(const std::string& name, std::time_t& date);
+
+// Give every local day from the one holding firstRow to the one holding
+// lastRow its own day partition, for loading old data. Days after the latest
+// partition are added; days an existing partition currently covers are split
+// off it with REORGANIZE PARTITION. That copies the partition's rows under a
+// lock, so nothing is changed if any partition to split holds rows. Logs and
+// returns false on failure.
+bool createDayPartitions(MYSQL* conn, const std::string& tableName, std::time_t firstRow, std::time_t lastRow);
+
+// Keeps day partitions of a table created ahead of time from a background
+// thread, so the insert path never has to query information_schema. Runs at
+// startup, shortly after every local midnight, and whenever requestRun() is
+// called.
+class PartitionMaintainer {
+public:
+    // Called after every successful run with the partition horizon: rows with
+    // a timestamp before this time have a partition to go into.
+    using HorizonCallback = std::function<void(std::time_t)>;
+
+    PartitionMaintainer(const DbConfig& dbConfig, const std::string& tableName, int daysAhead,
+                        HorizonCallback onHorizon);
+    ~PartitionMaintainer();
+
+    // Wake the maintenance thread early; never blocks on the database
+    void requestRun();
+
+private:
+    void run();
+    bool ensurePartitions();
+
+    DbConfig m_dbConfig;
+    std::string m_tableName;
+    int m_daysAhead;
+    HorizonCallback m_onHorizon;
+    MYSQL* m_conn;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_runRequested;
+    bool m_stopping;
+};
+
+#endif // PARTITION_MAINTAINER_H
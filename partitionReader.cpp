@@ -0,0 +1,187 @@
+#include "partitionReader.h"
+#include "logger.h"
+#include <cstring>
+
+PartitionReader::PartitionReader(MYSQL* conn, const std::string& tableName, const std::string& partitionName,
+                                 const std::string& selectList, const ExportOptions& options)
+    : m_conn(conn)
+    , m_tableName(tableName)
+    , m_partitionName(partitionName)
+    , m_selectList(selectList)
+    , m_options(options)
+    , m_result(NULL)
+    , m_fieldCount(0)
+    , m_chunked(options.chunkRows > 0)
+    , m_started(false)
+    , m_finished(false)
+    , m_lastRow(NULL)
+    , m_chunkRowsRead(0)
+    , m_unchargedBytes(0) {}
+
+PartitionReader::~PartitionReader() {
+    if (m_result != NULL) {
+        // Drain an unbuffered result so the connection stays usable
+        if (!m_chunked) {
+            while (mysql_fetch_row(m_result)) {
+            }
+        }
+        mysql_free_result(m_result);
+    }
+}
+
+bool PartitionReader::next(MYSQL_ROW& row, unsigned long*& lengths) {
+    if (!m_started) {
+        m_started = true;
+        if (!start()) {
+            m_finished = true;
+        }
+    }
+
+    while (!m_finished) {
+        if (m_result != NULL && (row = mysql_fetch_row(m_result)) != NULL) {
+            lengths = mysql_fetch_lengths(m_result);
+            if (m_chunked) {
+                for (unsigned int i = 0; i < m_fieldCount; ++i) {
+                    m_unchargedBytes += lengths[i];
+                }
+                m_lastRow = row;
+                ++m_chunkRowsRead;
+            }
+            return true;
+        }
+
+        if (!m_chunked) {
+            if (mysql_errno(m_conn) != 0) {
+                fail("Failed while reading partition " + m_partitionName);
+            }
+            m_finished = true;
+        } else if (!nextChunk()) {
+            m_finished = true;
+        }
+    }
+    return false;
+}
+
+// Find the key a chunked read walks, or stream the partition
+bool PartitionReader::start() {
+    if (m_chunked) {
+        if (!findPrimaryKey()) {
+            return false;
+        }
+        if (!m_keyColumns.empty()) {
+            return true;
+        }
+        LOG_WARNING("Table " << m_tableName << " has no primary key, reading partition " << m_partitionName
+                    << " with one unthrottled SELECT");
+        m_chunked = false;
+    }
+
+    std::string query = "SELECT " + m_selectList + " FROM " + m_tableName + " PARTITION (" + m_partitionName + ");";
+    if (mysql_query(m_conn, query.c_str())) {
+        fail("Failed to fetch partition data");
+        return false;
+    }
+    // Stream rows instead of buffering the whole partition client-side
+    m_result = mysql_use_result(m_conn);
+    if (m_result == NULL) {
+        fail("Failed to read result");
+        return false;
+    }
+    m_fieldCount = mysql_num_fields(m_result);
+    return true;
+}
+
+bool PartitionReader::findPrimaryKey() {
+    std::string query = "SELECT column_name FROM information_schema.statistics "
+                        "WHERE table_schema = DATABASE() AND table_name = '" + m_tableName + "' "
+                        "AND index_name = 'PRIMARY' ORDER BY seq_in_index;";
+    if (mysql_query(m_conn, query.c_str())) {
+        fail("Failed to fetch the primary key of " + m_tableName);
+        return false;
+    }
+    MYSQL_RES* result = mysql_store_result(m_conn);
+    if (result == NULL) {
+        fail("Failed to read result");
+        return false;
+    }
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result))) {
+        if (row[0]) {
+            m_keyColumns.push_back(row[0]);
+        }
+    }
+    mysql_free_result(result);
+    return true;
+}
+
+// Fetch the next chunkRows rows after the last key read. A chunk that came
+// back short was the end of the partition.
+bool PartitionReader::nextChunk() {
+    if (m_result != NULL) {
+        bool last = m_chunkRowsRead < m_options.chunkRows;
+        if (!last) {
+            m_lastKey.clear();
+            for (size_t i = 0; i < m_keyColumns.size(); ++i) {
+                const char* value = m_lastRow[m_fieldCount + i];
+                size_t length = value != NULL ? std::strlen(value) : 0;
+                std::string escaped(2 * length + 1, '\0');
+                escaped.resize(mysql_real_escape_string(m_conn, &escaped[0], value != NULL ? value : "", length));
+                m_lastKey.push_back("'" + escaped + "'");
+            }
+        }
+        mysql_free_result(m_result);
+        m_result = NULL;
+        if (last) {
+            charge(m_unchargedBytes);
+            return false;
+        }
+    }
+    charge(m_unchargedBytes);
+    m_chunkRowsRead = 0;
+    m_lastRow = NULL;
+
+    std::string keyList;
+    for (const auto& column : m_keyColumns) {
+        keyList += (keyList.empty() ? "" : ", ") + column;
+    }
+    std::string query = "SELECT " + m_selectList + ", " + keyList + " FROM " + m_tableName + " PARTITION (" +
+                        m_partitionName + ")" + (m_lastKey.empty() ? "" : " WHERE " + afterLastKey()) +
+                        " ORDER BY " + keyList + " LIMIT " + std::to_string(m_options.chunkRows) + ";";
+
+    if (mysql_query(m_conn, query.c_str())) {
+        fail("Failed to fetch partition data");
+        return false;
+    }
+    m_result = mysql_store_result(m_conn);
+    if (m_result == NULL) {
+        fail("Failed to read result");
+        return false;
+    }
+    m_fieldCount = mysql_num_fields(m_result) - static_cast<unsigned int>(m_keyColumns.size());
+    return true;
+}
+
+// Keys after m_lastKey, spelled out column by column so the optimizer reads
+// them as a range on the primary key: k1 > v1 OR (k1 = v1 AND k2 > v2) ...
+std::string PartitionReader::afterLastKey() {
+    std::string condition;
+    for (size_t i = 0; i < m_keyColumns.size(); ++i) {
+        condition += condition.empty() ? "(" : " OR (";
+        for (size_t j = 0; j < i; ++j) {
+            condition += m_keyColumns[j] + " = " + m_lastKey[j] + " AND ";
+        }
+        condition += m_keyColumns[i] + " > " + m_lastKey[i] + ")";
+    }
+    return condition;
+}
+
+void PartitionReader::charge(size_t bytes) {
+    if (m_options.throttle && bytes > 0) {
+        m_options.throttle->acquire(bytes);
+    }
+    m_unchargedBytes = 0;
+}
+
+void PartitionReader::fail(const std::string& what) {
+    m_error = what + ": " + mysql_error(m_conn);
+}
@@ -0,0 +1,69 @@
+#ifndef PARTITION_READER_H
+#define PARTITION_READER_H
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <mariadb/mysql.h>
+#include "exportThrottle.h"
+
+// How archival reads partitions out of the database
+struct ExportOptions {
+    // Read in chunks of this many rows; 0 streams the whole partition from
+    // one SELECT, which is not throttled as pausing would keep it open
+    size_t chunkRows = 20000;
+    // Read budget shared by every export, or null for none
+    std::shared_ptr<ExportThrottle> throttle;
+};
+
+// Reads the rows of one partition for archiving. A chunked read walks the
+// table's primary key: each chunk is a SELECT of the next chunkRows rows
+// after the last key read, ordered by the key, so every chunk is a short
+// index range read however large the partition, and the throttle pauses
+// only between statements. A table without a primary key cannot be read
+// that way and is streamed with one SELECT.
+class PartitionReader {
+public:
+    // selectList is the column list of the SELECT, e.g. telemetryColumnList()
+    PartitionReader(MYSQL* conn, const std::string& tableName, const std::string& partitionName,
+                    const std::string& selectList, const ExportOptions& options);
+    ~PartitionReader();
+
+    PartitionReader(const PartitionReader&) = delete;
+    PartitionReader& operator=(const PartitionReader&) = delete;
+
+    // Next row and its column lengths; false once the partition is read or on error
+    bool next(MYSQL_ROW& row, unsigned long*& lengths);
+    // Why reading stopped early, empty if it did not
+    const std::string& error() const { return m_error; }
+
+private:
+    bool start();
+    bool findPrimaryKey();
+    bool nextChunk();
+    std::string afterLastKey();
+    void charge(size_t bytes);
+    void fail(const std::string& what);
+
+    MYSQL* m_conn;
+    std::string m_tableName;
+    std::string m_partitionName;
+    std::string m_selectList;
+    ExportOptions m_options;
+
+    MYSQL_RES* m_result;
+    unsigned int m_fieldCount;      ///< Columns of selectList; chunked reads add the key columns after them
+    bool m_chunked;
+    bool m_started;
+    bool m_finished;
+    std::string m_error;
+
+    // Chunked reads
+    std::vector<std::string> m_keyColumns;  ///< Primary key, in index order
+    std::vector<std::string> m_lastKey;     ///< Quoted key of the last row read, empty before the first chunk
+    MYSQL_ROW m_lastRow;            ///< Last row of the current chunk, valid until its result is freed
+    size_t m_chunkRowsRead;
+    size_t m_unchargedBytes;        ///< Read but not yet passed to the throttle
+};
+
+#endif // PARTITION_READER_H
@@ -0,0 +1,172 @@
+#include "queryServer.h"
+#include "logger.h"
+#include "msgpackFields.h"
+#include <chrono>
+
+namespace {
+// How often the serving thread checks for shutdown while idle
+constexpr auto POLL_INTERVAL = std::chrono::milliseconds(500);
+
+void packString(msgpack::packer<msgpack::sbuffer>& packer, const std::string& value) {
+    packer.pack_str(static_cast<uint32_t>(value.size()));
+    packer.pack_str_body(value.data(), static_cast<uint32_t>(value.size()));
+}
+
+void packError(msgpack::sbuffer& reply, const std::string& error) {
+    msgpack::packer<msgpack::sbuffer> packer(reply);
+    packer.pack_map(2);
+    packString(packer, "ok");
+    packer.pack_false();
+    packString(packer, "error");
+    packString(packer, error);
+}
+
+void packRows(msgpack::sbuffer& reply, const RecentRows& rows) {
+    msgpack::packer<msgpack::sbuffer> packer(reply);
+    packer.pack_map(static_cast<uint32_t>(3 + rows.columns.size()));
+    packString(packer, "ok");
+    packer.pack_true();
+    packString(packer, "rows");
+    packer.pack_uint64(rows.timestamps.size());
+
+    packString(packer, "timestamp");
+    packer.pack_array(static_cast<uint32_t>(rows.timestamps.size()));
+    for (uint64_t timestamp : rows.timestamps) {
+        packer.pack_uint64(timestamp);
+    }
+
+    for (const auto& column : rows.columns) {
+        packString(packer, column.name);
+        if (column.isString) {
+            packer.pack_array(static_cast<uint32_t>(column.strings.size()));
+            for (const auto& value : column.strings) {
+                packString(packer, value);
+            }
+        } else {
+            packer.pack_array(static_cast<uint32_t>(column.numbers.size()));
+            for (uint32_t value : column.numbers) {
+                packer.pack_uint32(value);
+            }
+        }
+    }
+}
+} // namespace
+
+QueryServer::QueryServer(std::shared_ptr<RecentCache> cache, const std::string& endpoint)
+    : m_cache(cache)
+    , m_context(1)
+    , m_socket(m_context, zmq::socket_type::rep)
+    , m_running(true) {
+    m_socket.bind(endpoint);
+    m_thread = std::thread(&QueryServer::serve, this);
+}
+
+QueryServer::~QueryServer() {
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void QueryServer::serve() {
+    zmq::message_t request;
+    msgpack::sbuffer reply;
+
+    while (m_running) {
+        zmq::pollitem_t item = {static_cast<void*>(m_socket), 0, ZMQ_POLLIN, 0};
+        try {
+            if (zmq::poll(&item, 1, POLL_INTERVAL) == 0 || !m_socket.recv(request, zmq::recv_flags::none)) {
+                continue;
+            }
+
+            reply.clear();
+            handleRequest(request, reply);
+            m_socket.send(zmq::buffer(reply.data(), reply.size()), zmq::send_flags::none);
+        } catch (const zmq::error_t& e) {
+            LOG_ERROR("Query server error: " << e.what());
+        }
+    }
+}
+
+void QueryServer::handleRequest(const zmq::message_t& request, msgpack::sbuffer& reply) {
+    m_zone.clear();
+    msgpack::object message;
+    try {
+        std::size_t offset = 0;
+        message = msgpack::unpack(m_zone, static_cast<const char*>(request.data()), request.size(), offset);
+    } catch (const std::exception& e) {
+        packError(reply, std::string("Malformed request: ") + e.what());
+        return;
+    }
+    if (message.type != msgpack::type::MAP) {
+        packError(reply, "Request is not a map");
+        return;
+    }
+    const msgpack::object_map& fields = message.via.map;
+
+    std::string query;
+    const msgpack::object* queryValue = findField(fields, "query");
+    if (queryValue == nullptr || !readString(*queryValue, query)) {
+        packError(reply, "Missing query");
+        return;
+    }
+
+    std::vector<std::string> requested;
+    if (const msgpack::object* fieldList = findField(fields, "fields")) {
+        if (fieldList->type != msgpack::type::ARRAY) {
+            packError(reply, "fields must be an array");
+            return;
+        }
+        std::string name;
+        for (uint32_t i = 0; i < fieldList->via.array.size; ++i) {
+            if (!readString(fieldList->via.array.ptr[i], name)) {
+                packError(reply, "fields must be strings");
+                return;
+            }
+            requested.push_back(name);
+        }
+    }
+
+    std::optional<uint32_t> serialNumber;
+    if (const msgpack::object* serialValue = findField(fields, "serialNumber")) {
+        uint32_t value;
+        if (!readUint(*serialValue, value)) {
+            packError(reply, "serialNumber must be unsigned");
+            return;
+        }
+        serialNumber = value;
+    }
+
+    RecentRows rows;
+    std::string error;
+    bool found;
+    if (query == "range") {
+        uint64_t fromMs = 0;
+        uint64_t toMs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        const msgpack::object* from = findField(fields, "from");
+        const msgpack::object* to = findField(fields, "to");
+        if (from == nullptr || !readUint(*from, fromMs) || (to != nullptr && !readUint(*to, toMs))) {
+            packError(reply, "range needs unsigned from and to");
+            return;
+        }
+        found = m_cache->range(fromMs, toMs, serialNumber, requested, rows, error);
+    } else if (query == "last") {
+        uint64_t count = 0;
+        const msgpack::object* countValue = findField(fields, "count");
+        if (countValue == nullptr || !readUint(*countValue, count)) {
+            packError(reply, "last needs an unsigned count");
+            return;
+        }
+        found = m_cache->last(static_cast<size_t>(count), serialNumber, requested, rows, error);
+    } else {
+        packError(reply, "Unknown query: " + query);
+        return;
+    }
+
+    if (!found) {
+        packError(reply, error);
+        return;
+    }
+    packRows(reply, rows);
+}
@@ -0,0 +1,43 @@
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <zmq.hpp>
+#include <msgpack.hpp>
+#include "recentCache.h"
+
+// Answers recent-data queries from a RecentCache over a ZMQ REP socket, so
+// dashboards never have to read the database for the last few minutes.
+//
+// Requests and replies are msgpack maps:
+//   {"query": "range", "from": <ms>, "to": <ms>, "serialNumber": <n>, "fields": ["powerReading", ...]}
+//   {"query": "last", "count": <n>, "serialNumber": <n>, "fields": [...]}
+//   -> {"ok": true, "rows": <n>, "timestamp": [...], "<field>": [...], ...}
+//   -> {"ok": false, "error": "<message>"}
+// "fields" is optional and defaults to every field; "to" defaults to now.
+// Without "serialNumber" rows of every device are returned, interleaved;
+// ask for "serialNumber" among the fields to tell them apart.
+class QueryServer {
+public:
+    QueryServer(std::shared_ptr<RecentCache> cache, const std::string& endpoint);
+    ~QueryServer();
+
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+private:
+    void serve();
+    void handleRequest(const zmq::message_t& request, msgpack::sbuffer& reply);
+
+    std::shared_ptr<RecentCache> m_cache;
+    zmq::context_t m_context;
+    zmq::socket_t m_socket;
+    msgpack::zone m_zone;
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+};
+
+#endif // QUERY_SERVER_H
@@ -1,60 +1,219 @@
 #include "receiver.h"
-#include <iostream>
+#include "logger.h"
+#include "msgpackFields.h"
+#include "metrics.h"
+#include <algorithm>
 
-Receiver::Receiver(std::shared_ptr<DataStorage> storage) 
+namespace {
+// Key of the counter a publisher stamps on every message it sends; messages
+// without one are received as usual but cannot be checked for gaps
+const char* const SEQUENCE_KEY = "sequence";
+// Frames each decode worker can have queued or in hand; stays below the inproc HWM
+constexpr size_t DECODE_SLOTS_PER_WORKER = 256;
+}
+
+Receiver::Receiver(std::shared_ptr<DataStorage> storage, const std::vector<std::string>& addresses,
+                   const ReceiveOptions& options)
     : context(1)
-    , zmq_subscriber(context, zmq::socket_type::sub)
     , m_storage(storage)
+    , m_options(options)
     , messageCount(0) {
     
-    zmq_subscriber.connect("tcp://127.0.0.1:5555");
-    zmq_subscriber.set(zmq::sockopt::subscribe, "");  // Subscribe to all messages
+    for (size_t i = 0; i < addresses.size(); ++i) {
+        zmq::socket_t socket(context, zmq::socket_type::sub);
+        // Both only apply to connections made after they are set
+        socket.set(zmq::sockopt::rcvhwm, m_options.receiveHwm);
+        socket.set(zmq::sockopt::rcvbuf, m_options.receiveBufferBytes);
+        socket.connect(addresses[i]);
+        socket.set(zmq::sockopt::subscribe, "");  // Subscribe to all messages
+        endpoints.push_back(Endpoint{addresses[i], std::move(socket), DataStorage::provisionalDevice(i),
+                                     &pipelineMetrics().addPublisher(addresses[i]), false, 0});
+    }
+    for (auto& endpoint : endpoints) {
+        pollItems.push_back(zmq::pollitem_t{static_cast<void*>(endpoint.socket), 0, ZMQ_POLLIN, 0});
+    }
+    if (m_options.decodeWorkers > 0) {
+        m_decodePool = std::make_unique<DecodePool>(context, m_options.decodeWorkers, DECODE_SLOTS_PER_WORKER);
+        pollItems.push_back(zmq::pollitem_t{static_cast<void*>(m_decodePool->completions()), 0, ZMQ_POLLIN, 0});
+    }
 }
 
 void Receiver::receiveData() {
-    const int INSERT_THRESHOLD = 8;
-    
+    // Upper bound on a poll when no device has messages waiting to be captured
+    const auto IDLE_POLL_TIMEOUT = std::chrono::milliseconds(1000);
+    zmq::message_t message;
+    auto nextCapture = std::chrono::steady_clock::time_point::max();
+
     while (true) {
-        zmq::message_t message;
-        if (zmq_subscriber.recv(message, zmq::recv_flags::none)) {
-            messageCount++;
-
-            // Deserialize the received data
-            msgpack::object_handle oh = msgpack::unpack(static_cast<const char*>(message.data()), message.size());
-            msgpack::object deserialized = oh.get();
-
-            // Unpack the data into a map
-            std::unordered_map<std::string, msgpack::object> dataMap;
-            deserialized.convert(dataMap);
-            
-
-            try {
-                uint16_t commandID = dataMap.at("commandID").as<uint16_t>();
-
-                // Handle based on the commandID using a switch statement
-                switch (commandID) {
-                    case PARSE_VERSION: m_storage->handleVersion(dataMap); break;
-                    case PARSE_POWER: m_storage->handlePower(dataMap); break;
-                    case PARSE_LASERHEAD_FLOW: m_storage->handleLaserheadFlow(dataMap); break;
-                    case PARSE_PWM_MODULATION: m_storage->handlePWMModulation(dataMap); break;
-                    case PARSE_DC_INFO: m_storage->handleDcInfo(dataMap); break;
-                    case PARSE_RF_INFO: m_storage->handleRfInfo(dataMap); break;
-                    case PARSE_SYSTEM_INFO: m_storage->handleSystemInfo(dataMap); break;
-                    default: 
-                        std::cerr << "Unknown commandID received: 0x" << std::hex << commandID << std::dec << std::endl;
-                        break;
-                }
-
-                // Check if we've reached the insert threshold
-                if (messageCount % INSERT_THRESHOLD == 0) {
-                    m_storage->insertAllData();
-                }
-
-            } catch (const std::out_of_range&) {
-                std::cerr << "Missing commandID key in received data" << std::endl;
-            } catch (const msgpack::type_error&) {
-                std::cerr << "Invalid type for commandID key in received data" << std::endl;
+        // Sleep until a message arrives or the next device's oldest uncaptured message reaches maxLatency
+        std::chrono::milliseconds timeout = IDLE_POLL_TIMEOUT;
+        if (nextCapture != std::chrono::steady_clock::time_point::max()) {
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(nextCapture - std::chrono::steady_clock::now());
+            timeout = std::max(std::chrono::milliseconds(0), std::min(timeout, remaining));
+        }
+        // While every decode slot is in flight, leave new messages queued on their sockets
+        short endpointEvents = !m_decodePool || m_decodePool->nextFree() != nullptr ? ZMQ_POLLIN : 0;
+        for (size_t i = 0; i < endpoints.size(); ++i) {
+            pollItems[i].events = endpointEvents;
+        }
+        zmq::poll(pollItems, timeout);
+
+        // Take everything already queued on each ready socket before polling again
+        for (size_t i = 0; i < endpoints.size(); ++i) {
+            if (pollItems[i].revents & ZMQ_POLLIN) {
+                drainEndpoint(i, message);
             }
         }
+        if (m_decodePool) {
+            dispatchDecoded();
+        }
+
+        // Rows are also captured by handleMessage() once a device has sent messagesPerRow messages
+        nextCapture = m_storage->captureDueRows();
+    }
+}
+
+// Receive messages from one socket until it has none left or maxDrain have
+// been taken. Without decode workers each is decoded and dispatched here, and
+// message is reused for every frame; with them each goes into a free slot of
+// the decode pool, which reuses its own frames.
+void Receiver::drainEndpoint(size_t endpoint, zmq::message_t& message) {
+    PipelineMetrics& metrics = pipelineMetrics();
+    size_t received = 0;
+    while (received < m_options.maxDrain) {
+        DecodePool::Frame* frame = nullptr;
+        if (m_decodePool) {
+            frame = m_decodePool->nextFree();
+            if (frame == nullptr) {
+                break;
+            }
+        }
+        zmq::message_t& target = frame != nullptr ? frame->data : message;
+
+        auto start = std::chrono::steady_clock::now();
+        if (!endpoints[endpoint].socket.recv(target, zmq::recv_flags::dontwait)) {
+            break;
+        }
+        metrics.receive.record(std::chrono::steady_clock::now() - start);
+        ++received;
+        messageCount++;
+        metrics.messages.add();
+
+        if (frame != nullptr) {
+            frame->endpoint = endpoint;
+            m_decodePool->submit();
+        } else {
+            decodeMessage(endpoint, message);
+        }
+    }
+}
+
+// Dispatch what the decode workers have finished, in the order it was received
+void Receiver::dispatchDecoded() {
+    m_decodePool->drainCompletions();
+    while (DecodePool::Frame* frame = m_decodePool->nextDecoded()) {
+        if (frame->valid) {
+            dispatchMessage(frame->endpoint, frame->message);
+        } else {
+            LOG_ERROR_LIMITED("Failed to unpack data from " << endpoints[frame->endpoint].address << ": "
+                              << frame->error);
+            pipelineMetrics().decodeErrors.add();
+        }
+        m_decodePool->release();
     }
-}
\ No newline at end of file
+}
+
+void Receiver::decodeMessage(size_t endpoint, const zmq::message_t& message) {
+    PipelineMetrics& metrics = pipelineMetrics();
+
+    // Deserialize the received data in place; the zone keeps its memory between messages
+    m_zone.clear();
+    msgpack::object deserialized;
+    try {
+        StageTimer timer(metrics.decode);
+        deserialized = unpackFrame(m_zone, message);
+    } catch (const std::exception& e) {
+        LOG_ERROR_LIMITED("Failed to unpack data from " << endpoints[endpoint].address << ": " << e.what());
+        metrics.decodeErrors.add();
+        return;
+    }
+    dispatchMessage(endpoint, deserialized);
+}
+
+// Count the sequence numbers missing between this message and the last one
+// from the same publisher. PUB/SUB over one connection never reorders, so a
+// number at or below the last one means the publisher started over.
+void Receiver::trackSequence(Endpoint& source, const msgpack::object_map& fields) {
+    const msgpack::object* sequenceValue = findField(fields, SEQUENCE_KEY);
+    uint64_t sequence;
+    if (sequenceValue == nullptr || !readUint(*sequenceValue, sequence)) {
+        return;
+    }
+    source.publisher->messages.add();
+
+    if (source.sequenced) {
+        if (sequence > source.lastSequence) {
+            uint64_t lost = sequence - source.lastSequence - 1;
+            if (lost > 0) {
+                source.publisher->lost.add(lost);
+                pipelineMetrics().messagesLost.add(lost);
+                LOG_WARNING_LIMITED("Lost " << lost << " messages from " << source.address
+                                    << " before sequence " << sequence);
+            }
+        } else {
+            source.publisher->restarts.add();
+            LOG_WARNING_LIMITED("Sequence from " << source.address << " went back from "
+                                << source.lastSequence << " to " << sequence);
+        }
+    }
+    source.sequenced = true;
+    source.lastSequence = sequence;
+}
+
+// Route a message to its handler; false if it carries no usable commandID
+bool Receiver::dispatchMessage(size_t endpoint, const msgpack::object& message) {
+    if (message.type != msgpack::type::MAP) {
+        LOG_ERROR_LIMITED("Received data is not a map");
+        return false;
+    }
+    const msgpack::object_map& fields = message.via.map;
+    Endpoint& source = endpoints[endpoint];
+    trackSequence(source, fields);
+
+    const msgpack::object* commandValue = findField(fields, "commandID");
+    if (commandValue == nullptr) {
+        LOG_ERROR_LIMITED("Missing commandID key in received data");
+        return false;
+    }
+    uint16_t commandID;
+    if (!readUint(*commandValue, commandID)) {
+        LOG_ERROR_LIMITED("Invalid type for commandID key in received data");
+        return false;
+    }
+
+    // Only system info carries the serialNumber, so messages cannot be told
+    // apart by device: every message on an endpoint belongs to its one device.
+    // A different serialNumber later means that device has been replaced.
+    const msgpack::object* serialValue = findField(fields, "serialNumber");
+    uint32_t serialNumber;
+    if (serialValue != nullptr && readUint(*serialValue, serialNumber) && serialNumber != source.device) {
+        if (source.device == DataStorage::provisionalDevice(endpoint)) {
+            m_storage->adoptDevice(source.device, serialNumber);
+        } else {
+            LOG_WARNING_LIMITED("Device on " << source.address << " changed from serialNumber " << source.device
+                                << " to " << serialNumber << "; each device needs its own endpoint");
+        }
+        source.device = serialNumber;
+    }
+
+    // Handle based on the commandID; the dispatch is generated from the telemetry schema
+    bool known;
+    {
+        StageTimer timer(pipelineMetrics().dispatchFor(commandID));
+        known = m_storage->handleMessage(source.device, commandID, fields);
+    }
+    if (!known) {
+        LOG_ERROR_LIMITED("Unknown commandID received: 0x" << std::hex << commandID << std::dec);
+    }
+    return true;
+}
@@ -1,25 +1,59 @@
 #include <zmq.hpp>
 #include <msgpack.hpp>
 #include <memory>
+#include <chrono>
+#include <string>
+#include <vector>
 #include "dataStorage.h"
+#include "decodePool.h"
+#include "metrics.h"
+#include "telemetrySchema.h"
 
-constexpr uint16_t PARSE_VERSION = 0x72;
-constexpr uint16_t PARSE_POWER = 0x6B;
-constexpr uint16_t PARSE_LASERHEAD_FLOW = 0x6a;
-constexpr uint16_t PARSE_DC_INFO = 0xD1;
-constexpr uint16_t PARSE_PWM_MODULATION = 0xE8;
-constexpr uint16_t PARSE_RF_INFO = 0xEF;
-constexpr uint16_t PARSE_SYSTEM_INFO = 0xa000;
+// Socket settings for the SUB sockets. A SUB socket drops messages silently
+// once receiveHwm are queued for it, so size it for the longest stall the
+// receive thread should ride out; sequence numbers make any drop visible.
+struct ReceiveOptions {
+    int receiveHwm = 1000;              ///< ZMQ_RCVHWM, messages queued per publisher
+    int receiveBufferBytes = -1;        ///< ZMQ_RCVBUF, kernel socket buffer; -1 keeps the OS default
+    size_t maxDrain = 1024;             ///< Messages taken from one socket per wakeup before the others get a turn
+    size_t decodeWorkers = 0;           ///< Threads unpacking messages; 0 unpacks on the receive thread
+};
 
 class Receiver {
 public:
-    Receiver(std::shared_ptr<DataStorage> storage);
+    // Subscribe to every endpoint. Each endpoint carries exactly one device:
+    // messages other than system info have no serialNumber, so devices
+    // sharing an endpoint could not be told apart.
+    Receiver(std::shared_ptr<DataStorage> storage,
+             const std::vector<std::string>& addresses = {"tcp://127.0.0.1:5555"},
+             const ReceiveOptions& options = ReceiveOptions());
     void receiveData();
 
 private:
+    // One SUB socket per publisher, with its device: provisional until the serialNumber arrives
+    struct Endpoint {
+        std::string address;
+        zmq::socket_t socket;
+        DataStorage::DeviceKey device;
+        PublisherMetrics* publisher;
+        bool sequenced;                 ///< lastSequence holds a sequence number seen
+        uint64_t lastSequence;
+    };
+
+    void drainEndpoint(size_t endpoint, zmq::message_t& message);
+    void decodeMessage(size_t endpoint, const zmq::message_t& message);
+    void dispatchDecoded();
+    bool dispatchMessage(size_t endpoint, const msgpack::object& message);
+    void trackSequence(Endpoint& source, const msgpack::object_map& fields);
+
     zmq::context_t context;
-    zmq::socket_t zmq_subscriber;
+    std::vector<Endpoint> endpoints;
+    std::vector<zmq::pollitem_t> pollItems;     ///< Indexed like endpoints, then the decode pool's completions
     std::shared_ptr<DataStorage> m_storage;
+    ReceiveOptions m_options;
+    std::unique_ptr<DecodePool> m_decodePool;   ///< Only with decodeWorkers
+    // Unpacked objects live here; cleared per message so its first chunk is reused
+    msgpack::zone m_zone;
     int messageCount;
     static constexpr int PUBLISH_INTERVAL = 15;
 };
\ No newline at end of file
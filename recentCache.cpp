@@ -0,0 +1,158 @@
+#include "recentCache.h"
+#include <algorithm>
+
+namespace {
+
+void copyValues(const std::vector<uint32_t>& source, const std::vector<size_t>& positions, RecentColumn& out) {
+    out.isString = false;
+    out.numbers.reserve(positions.size());
+    for (size_t position : positions) {
+        out.numbers.push_back(source[position]);
+    }
+}
+
+void copyValues(const std::vector<TelemetryString>& source, const std::vector<size_t>& positions, RecentColumn& out) {
+    out.isString = true;
+    out.strings.reserve(positions.size());
+    for (size_t position : positions) {
+        out.strings.emplace_back(source[position].data, source[position].length);
+    }
+}
+
+} // namespace
+
+RecentCache::RecentCache(size_t capacityRows, std::chrono::milliseconds window)
+    : m_capacity(capacityRows > 0 ? capacityRows : 1)
+    , m_window(window)
+    , m_next(0)
+    , m_size(0) {
+#define RECENT_CACHE_RESIZE(command, name, type) m_columns.name.resize(m_capacity);
+    TELEMETRY_FIELDS(RECENT_CACHE_RESIZE)
+#undef RECENT_CACHE_RESIZE
+    m_columns.timestampMs.resize(m_capacity);
+}
+
+void RecentCache::append(const Snapshot& snapshot) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+#define RECENT_CACHE_STORE(command, name, type) m_columns.name[m_next] = snapshot.name;
+    TELEMETRY_FIELDS(RECENT_CACHE_STORE)
+#undef RECENT_CACHE_STORE
+    m_columns.timestampMs[m_next] = snapshot.timestampMs;
+    uint64_t& newest = m_newestMs[snapshot.serialNumber];
+    newest = std::max(newest, snapshot.timestampMs);
+
+    m_next = (m_next + 1) % m_capacity;
+    if (m_size < m_capacity) {
+        ++m_size;
+    }
+}
+
+// Oldest timestamp of the device still inside the window; m_mutex must be held
+uint64_t RecentCache::windowStart(uint32_t serialNumber) const {
+    auto found = m_newestMs.find(serialNumber);
+    if (found == m_newestMs.end()) {
+        return 0;
+    }
+    uint64_t window = static_cast<uint64_t>(m_window.count());
+    return found->second > window ? found->second - window : 0;
+}
+
+// Whether the row at ring position at belongs to the device asked for and is
+// inside its window; m_mutex must be held
+bool RecentCache::selected(size_t at, std::optional<uint32_t> serialNumber) const {
+    uint32_t device = m_columns.serialNumber[at];
+    if (serialNumber && device != *serialNumber) {
+        return false;
+    }
+    return m_columns.timestampMs[at] >= windowStart(device);
+}
+
+bool RecentCache::resolveFields(const std::vector<std::string>& fields, std::vector<size_t>& indexes,
+                                std::string& error) const {
+    indexes.clear();
+    if (fields.empty()) {
+        for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; ++i) {
+            indexes.push_back(i);
+        }
+        return true;
+    }
+
+    for (const auto& field : fields) {
+        size_t index = 0;
+        while (index < TELEMETRY_FIELD_COUNT && field != TELEMETRY_COLUMNS[index]) {
+            ++index;
+        }
+        if (index == TELEMETRY_FIELD_COUNT) {
+            error = "Unknown field: " + field;
+            return false;
+        }
+        indexes.push_back(index);
+    }
+    return true;
+}
+
+// Copy the selected fields of the rows at positions; m_mutex must be held
+void RecentCache::collect(const std::vector<size_t>& positions, const std::vector<size_t>& fieldIndexes,
+                          RecentRows& out) const {
+    out.timestamps.clear();
+    out.timestamps.reserve(positions.size());
+    for (size_t position : positions) {
+        out.timestamps.push_back(m_columns.timestampMs[position]);
+    }
+
+    out.columns.clear();
+    out.columns.resize(fieldIndexes.size());
+    for (size_t i = 0; i < fieldIndexes.size(); ++i) {
+        RecentColumn& column = out.columns[i];
+        column.name = TELEMETRY_COLUMNS[fieldIndexes[i]];
+        size_t field = 0;
+#define RECENT_CACHE_COPY(command, name, type) \
+        if (fieldIndexes[i] == field++) { \
+            copyValues(m_columns.name, positions, column); \
+        }
+        TELEMETRY_FIELDS(RECENT_CACHE_COPY)
+#undef RECENT_CACHE_COPY
+    }
+}
+
+bool RecentCache::range(uint64_t fromMs, uint64_t toMs, std::optional<uint32_t> serialNumber,
+                        const std::vector<std::string>& fields, RecentRows& out, std::string& error) const {
+    std::vector<size_t> fieldIndexes;
+    if (!resolveFields(fields, fieldIndexes, error)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Only the timestamp and serialNumber columns are scanned to pick rows
+    std::vector<size_t> positions;
+    for (size_t i = 0; i < m_size; ++i) {
+        size_t at = position(i);
+        uint64_t timestamp = m_columns.timestampMs[at];
+        if (timestamp >= fromMs && timestamp <= toMs && selected(at, serialNumber)) {
+            positions.push_back(at);
+        }
+    }
+    collect(positions, fieldIndexes, out);
+    return true;
+}
+
+bool RecentCache::last(size_t count, std::optional<uint32_t> serialNumber, const std::vector<std::string>& fields,
+                       RecentRows& out, std::string& error) const {
+    std::vector<size_t> fieldIndexes;
+    if (!resolveFields(fields, fieldIndexes, error)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<size_t> positions;
+    for (size_t i = m_size; i > 0 && positions.size() < count; --i) {
+        size_t at = position(i - 1);
+        if (selected(at, serialNumber)) {
+            positions.push_back(at);
+        }
+    }
+    std::reverse(positions.begin(), positions.end());
+    collect(positions, fieldIndexes, out);
+    return true;
+}
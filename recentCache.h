@@ -0,0 +1,77 @@
+#ifndef RECENT_CACHE_H
+#define RECENT_CACHE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+#include "snapshot.h"
+
+// Values of one field for the rows selected by a query
+struct RecentColumn {
+    std::string name;
+    bool isString;
+    std::vector<uint32_t> numbers;
+    std::vector<std::string> strings;
+};
+
+struct RecentRows {
+    std::vector<uint64_t> timestamps;   ///< Epoch milliseconds, oldest first
+    std::vector<RecentColumn> columns;  ///< In the order requested
+};
+
+// Fixed-size ring of the most recent rows, stored column-wise: one array
+// per telemetry field plus one for the timestamp, all indexed by the same
+// ring position. A query scans only the timestamp array to pick rows and
+// then copies just the requested fields. Rows older than the window,
+// measured back from the newest row of the same device (serialNumber), are
+// never returned, so a device whose clock runs behind keeps its rows.
+//
+// append() is called by the receive thread; queries may come from any thread.
+class RecentCache {
+public:
+    RecentCache(size_t capacityRows, std::chrono::milliseconds window);
+
+    void append(const Snapshot& snapshot);
+
+    // Rows with fromMs <= timestamp <= toMs, of one device or of every device
+    // without a serialNumber. An empty field list selects every field.
+    // Returns false and sets error for an unknown field.
+    bool range(uint64_t fromMs, uint64_t toMs, std::optional<uint32_t> serialNumber,
+               const std::vector<std::string>& fields, RecentRows& out, std::string& error) const;
+    // The newest count rows, of one device or of every device
+    bool last(size_t count, std::optional<uint32_t> serialNumber, const std::vector<std::string>& fields,
+              RecentRows& out, std::string& error) const;
+
+    size_t capacity() const { return m_capacity; }
+    std::chrono::milliseconds window() const { return m_window; }
+
+private:
+    // Ring position of the i-th oldest row; m_mutex must be held
+    size_t position(size_t i) const { return (m_next + m_capacity - m_size + i) % m_capacity; }
+    uint64_t windowStart(uint32_t serialNumber) const;
+    bool selected(size_t at, std::optional<uint32_t> serialNumber) const;
+    bool resolveFields(const std::vector<std::string>& fields, std::vector<size_t>& indexes, std::string& error) const;
+    void collect(const std::vector<size_t>& positions, const std::vector<size_t>& fieldIndexes, RecentRows& out) const;
+
+    struct Columns {
+#define RECENT_CACHE_COLUMN(command, name, type) std::vector<type> name;
+        TELEMETRY_FIELDS(RECENT_CACHE_COLUMN)
+#undef RECENT_CACHE_COLUMN
+        std::vector<uint64_t> timestampMs;
+    };
+
+    const size_t m_capacity;
+    const std::chrono::milliseconds m_window;
+
+    mutable std::mutex m_mutex;
+    Columns m_columns;
+    size_t m_next;      ///< Ring position written by the next append()
+    size_t m_size;      ///< Rows held, up to m_capacity
+    std::unordered_map<uint32_t, uint64_t> m_newestMs;  ///< Newest timestamp appended per serialNumber
+};
+
+#endif // RECENT_CACHE_H
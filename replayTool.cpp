@@ -0,0 +1,451 @@
+// replay: backfill laser_data from raw msgpack captures
+//
+//   replay <capture> [--messages-per-row N] [--rows-per-load N]
+//
+// A capture is a sequence of frames, each a 4-byte little-endian length
+// followed by one msgpack message exactly as the publisher sent it. Frames
+// are decoded with the receiver's telemetry decoders and turned into rows at
+// the receiver's cadence (FlushPolicy messagesPerRow and maxLatency, the
+// latter measured on the publisher's timestamps). Rows are streamed to the
+// server with LOAD DATA LOCAL INFILE straight from memory, after the day
+// partitions for the capture's whole time span have been created.
+
+#include "dbConnection.h"
+#include "flushPolicy.h"
+#include "localInfile.h"
+#include "localTimeCache.h"
+#include "logger.h"
+#include "msgpackFields.h"
+#include "partitionMaintainer.h"
+#include "telemetryDecoder.h"
+#include <msgpack.hpp>
+#include <mariadb/mysql.h>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+// Bytes of the little-endian length in front of every frame
+constexpr size_t FRAME_HEADER_SIZE = 4;
+// Rows per LOAD DATA statement; each statement is its own transaction
+constexpr size_t DEFAULT_ROWS_PER_LOAD = 500000;
+// Rows are loaded into this table, like the receiver's
+const char* const TABLE_NAME = "laser_data";
+// Device of messages that arrive before any serialNumber, as in the receiver
+constexpr uint64_t PROVISIONAL_DEVICE = uint64_t(1) << 32;
+// Rows held while the serialNumber is still unknown, as in the receiver
+constexpr size_t MAX_HELD_ROWS = 4096;
+
+void printUsage() {
+    std::cerr << "Usage: replay <capture> [--messages-per-row N] [--rows-per-load N]\n"
+              << "  A capture holds frames of a 4-byte little-endian length and one msgpack message" << std::endl;
+}
+
+// Read-only mapping of a whole capture file
+class CaptureFile {
+public:
+    explicit CaptureFile(const std::string& path)
+        : m_data(nullptr)
+        , m_size(0) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw std::runtime_error("Failed to open capture: " + path);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to read capture size: " + path);
+        }
+        m_size = static_cast<size_t>(info.st_size);
+        if (m_size > 0) {
+            void* base = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Failed to map capture: " + path);
+            }
+            // Read front to back, twice
+            ::madvise(base, m_size, MADV_SEQUENTIAL);
+            m_data = static_cast<const char*>(base);
+        }
+        ::close(fd);
+    }
+
+    ~CaptureFile() {
+        if (m_data != nullptr) {
+            ::munmap(const_cast<char*>(m_data), m_size);
+        }
+    }
+
+    CaptureFile(const CaptureFile&) = delete;
+    CaptureFile& operator=(const CaptureFile&) = delete;
+
+    // Frame starting at offset, which is moved past it; false at the end of
+    // the capture or at a frame cut short
+    bool next(size_t& offset, const char*& frame, size_t& size) const {
+        if (m_size - offset < FRAME_HEADER_SIZE) {
+            return false;
+        }
+        const unsigned char* header = reinterpret_cast<const unsigned char*>(m_data + offset);
+        size = size_t(header[0]) | size_t(header[1]) << 8 | size_t(header[2]) << 16 | size_t(header[3]) << 24;
+        if (m_size - offset - FRAME_HEADER_SIZE < size) {
+            return false;
+        }
+        frame = m_data + offset + FRAME_HEADER_SIZE;
+        offset += FRAME_HEADER_SIZE + size;
+        return true;
+    }
+
+    size_t size() const { return m_size; }
+
+private:
+    const char* m_data;
+    size_t m_size;
+};
+
+// Unpack a frame that holds a map; its keys and strings point into frame
+bool unpackMap(msgpack::zone& zone, const char* frame, size_t size, msgpack::object_map& fields) {
+    msgpack::object message;
+    try {
+        std::size_t offset = 0;
+        bool referenced = false;
+        message = msgpack::unpack(zone, frame, size, offset, referenced, referenceBuffer);
+    } catch (const std::exception&) {
+        return false;
+    }
+    if (message.type != msgpack::type::MAP) {
+        return false;
+    }
+    fields = message.via.map;
+    return true;
+}
+
+// Earliest and latest publisher timestamp in the capture; false if it has none
+bool captureSpan(const CaptureFile& capture, uint64_t& firstMs, uint64_t& lastMs) {
+    msgpack::zone zone;
+    firstMs = UINT64_MAX;
+    lastMs = 0;
+    size_t offset = 0;
+    const char* frame;
+    size_t size;
+    while (capture.next(offset, frame, size)) {
+        zone.clear();
+        msgpack::object_map fields;
+        uint64_t timestampMs;
+        if (unpackMap(zone, frame, size, fields) && decodeTimestamp(fields, timestampMs) == nullptr) {
+            firstMs = std::min(firstMs, timestampMs);
+            lastMs = std::max(lastMs, timestampMs);
+        }
+    }
+    return firstMs <= lastMs;
+}
+
+// Turns the capture into LOAD DATA input: one tab-separated line per row in
+// TELEMETRY_COLUMNS order, produced as the server reads it
+class RowSource : public InfileSource {
+public:
+    RowSource(const CaptureFile& capture, const FlushPolicy& policy)
+        : m_capture(capture)
+        , m_policy(policy)
+        , m_offset(0)
+        , m_device(PROVISIONAL_DEVICE)
+        , m_textOffset(0)
+        , m_loadRows(0)
+        , m_loadLimit(0)
+        , m_drained(false)
+        , m_messages(0)
+        , m_rows(0)
+        , m_errors(0) {}
+
+    // Let the next read() calls hand out about rowLimit more rows
+    void startLoad(size_t rowLimit) {
+        m_loadRows = 0;
+        m_loadLimit = rowLimit;
+    }
+
+    // Up to size bytes of rows; 0 once the current load's rows have all been read
+    size_t read(char* buffer, size_t size) override {
+        // Keep only the part not read yet, less than a buffer's worth
+        m_text.erase(0, m_textOffset);
+        m_textOffset = 0;
+        while (m_text.size() < size && m_loadRows < m_loadLimit && !m_drained) {
+            produce();
+        }
+        size_t length = std::min(size, m_text.size());
+        std::memcpy(buffer, m_text.data(), length);
+        m_textOffset = length;
+        return length;
+    }
+
+    bool finished() const { return m_drained && m_textOffset == m_text.size(); }
+    uint64_t messages() const { return m_messages; }
+    uint64_t rows() const { return m_rows; }
+    uint64_t errors() const { return m_errors; }
+
+private:
+    struct Device {
+        Snapshot current;
+        uint32_t receivedMessages;  ///< telemetryMessageBit() of every message decoded into current
+        size_t pendingMessages;     ///< Messages applied since the last row
+        uint64_t firstPendingMs;    ///< Publisher timestamp of the first of them
+        std::deque<Snapshot> heldRows;  ///< Provisional device only: rows waiting for the serialNumber
+    };
+
+    // Handle the next frame; at the end of the capture, write the rows still pending
+    void produce() {
+        const char* frame;
+        size_t size;
+        if (m_capture.next(m_offset, frame, size)) {
+            handleFrame(frame, size);
+            return;
+        }
+        if (m_offset != m_capture.size()) {
+            LOG_WARNING("Capture ends in a truncated frame at byte " << m_offset);
+        }
+        for (auto& entry : m_devices) {
+            if (entry.second.pendingMessages > 0) {
+                appendRow(entry.first, entry.second);
+            }
+        }
+        // Never named by a serialNumber, so the receiver would not have stored them either
+        auto provisional = m_devices.find(PROVISIONAL_DEVICE);
+        if (provisional != m_devices.end()) {
+            m_errors += provisional->second.heldRows.size();
+            provisional->second.heldRows.clear();
+        }
+        m_drained = true;
+    }
+
+    // What Receiver::dispatchMessage() and DataStorage::handleMessage() do
+    // for a message, with the maxLatency timer run on publisher time
+    void handleFrame(const char* frame, size_t size) {
+        ++m_messages;
+        m_zone.clear();
+        msgpack::object_map fields;
+        const msgpack::object* commandValue;
+        uint16_t commandID;
+        if (!unpackMap(m_zone, frame, size, fields) ||
+            (commandValue = findField(fields, "commandID")) == nullptr || !readUint(*commandValue, commandID)) {
+            ++m_errors;
+            return;
+        }
+
+        const msgpack::object* serialValue = findField(fields, "serialNumber");
+        uint32_t serialNumber;
+        if (serialValue != nullptr && readUint(*serialValue, serialNumber) && serialNumber != m_device) {
+            if (m_device == PROVISIONAL_DEVICE) {
+                adoptDevice(serialNumber);
+            } else {
+                LOG_WARNING_LIMITED("Device changed from serialNumber " << m_device << " to " << serialNumber
+                                    << "; a capture holds one device");
+            }
+            m_device = serialNumber;
+        }
+        Device& device = deviceState(m_device);
+
+        uint64_t timestampMs;
+        bool timed = decodeTimestamp(fields, timestampMs) == nullptr;
+        // The receiver would have captured this row on its timer before the message arrived
+        if (timed && device.pendingMessages > 0 &&
+            timestampMs >= device.firstPendingMs + static_cast<uint64_t>(m_policy.maxLatency.count())) {
+            appendRow(m_device, device);
+        }
+
+        if (!decodeMessage(commandID, fields, device.current)) {
+            ++m_errors;
+            return;
+        }
+        device.receivedMessages |= telemetryMessageBit(commandID);
+        if (timed) {
+            device.current.timestampMs = timestampMs;
+        }
+        if (device.pendingMessages++ == 0) {
+            device.firstPendingMs = device.current.timestampMs;
+        }
+        if (device.pendingMessages >= m_policy.messagesPerRow) {
+            appendRow(m_device, device);
+        }
+    }
+
+    Device& deviceState(uint64_t key) {
+        auto found = m_devices.find(key);
+        if (found != m_devices.end()) {
+            return found->second;
+        }
+        Device& device = m_devices[key];
+        device.current = Snapshot{};
+        device.receivedMessages = 0;
+        device.pendingMessages = 0;
+        device.firstPendingMs = 0;
+        if (key <= UINT32_MAX) {
+            device.current.serialNumber = static_cast<uint32_t>(key);
+        }
+        return device;
+    }
+
+    // As DataStorage::adoptDevice(): merge the provisional state and write the rows held for it
+    void adoptDevice(uint64_t to) {
+        auto found = m_devices.find(PROVISIONAL_DEVICE);
+        if (found == m_devices.end()) {
+            return;
+        }
+        Device provisional = std::move(found->second);
+        m_devices.erase(found);
+
+        Device& device = deviceState(to);
+        mergeMessageFields(provisional.receivedMessages, provisional.current, device.current);
+        device.current.serialNumber = static_cast<uint32_t>(to);
+        device.receivedMessages |= provisional.receivedMessages;
+        if (provisional.pendingMessages > 0) {
+            if (device.pendingMessages == 0 || provisional.firstPendingMs < device.firstPendingMs) {
+                device.firstPendingMs = provisional.firstPendingMs;
+            }
+            device.pendingMessages += provisional.pendingMessages;
+        }
+
+        for (Snapshot& row : provisional.heldRows) {
+            row.serialNumber = static_cast<uint32_t>(to);
+            writeRow(row);
+        }
+    }
+
+    // Capture the device's current data as a row; held while the device has no serialNumber
+    void appendRow(uint64_t key, Device& device) {
+        device.pendingMessages = 0;
+        if (key != PROVISIONAL_DEVICE) {
+            writeRow(device.current);
+            return;
+        }
+        if (device.heldRows.size() >= MAX_HELD_ROWS) {
+            device.heldRows.pop_front();
+            ++m_errors;
+        }
+        device.heldRows.push_back(device.current);
+    }
+
+    void writeRow(const Snapshot& row) {
+        // Without any timestamp the row has no partition to go into
+        if (row.timestampMs == 0) {
+            ++m_errors;
+            return;
+        }
+#define REPLAY_APPEND_FIELD(command, name, type) \
+        appendField(row.name); \
+        m_text += '\t';
+        TELEMETRY_FIELDS(REPLAY_APPEND_FIELD)
+#undef REPLAY_APPEND_FIELD
+        char timestamp[32];
+        m_text.append(timestamp, m_timeCache.format(row.timestampMs, timestamp, sizeof(timestamp)));
+        m_text += '\n';
+        ++m_loadRows;
+        ++m_rows;
+    }
+
+    void appendField(uint32_t value) { appendInfileField(m_text, value); }
+    void appendField(const TelemetryString& value) { appendInfileField(m_text, value.data, value.length); }
+
+    const CaptureFile& m_capture;
+    FlushPolicy m_policy;
+    size_t m_offset;
+    msgpack::zone m_zone;
+    std::unordered_map<uint64_t, Device> m_devices;
+    uint64_t m_device;              ///< The capture's device; provisional until its serialNumber arrives
+    LocalTimeCache m_timeCache;
+
+    // Formatted rows the server has not read yet
+    std::string m_text;
+    size_t m_textOffset;
+    size_t m_loadRows;
+    size_t m_loadLimit;
+    bool m_drained;                 ///< Every frame handled and every pending row written
+
+    uint64_t m_messages;
+    uint64_t m_rows;
+    uint64_t m_errors;              ///< Frames that could not be decoded, and rows without a timestamp or device
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printUsage();
+        return 1;
+    }
+
+    std::string path = argv[1];
+    FlushPolicy policy;
+    size_t rowsPerLoad = DEFAULT_ROWS_PER_LOAD;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--messages-per-row" && i + 1 < argc) {
+            policy.messagesPerRow = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--rows-per-load" && i + 1 < argc) {
+            rowsPerLoad = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    int status = 1;
+    MYSQL* conn = NULL;
+    try {
+        CaptureFile capture(path);
+        uint64_t firstMs;
+        uint64_t lastMs;
+        if (!captureSpan(capture, firstMs, lastMs)) {
+            throw std::runtime_error("No timestamped messages in " + path);
+        }
+
+        conn = openInfileConnection(DbConfig());
+        if (conn == NULL) {
+            throw std::runtime_error("Failed to connect to the database");
+        }
+
+        if (!createDayPartitions(conn, TABLE_NAME, static_cast<std::time_t>(firstMs / 1000),
+                                 static_cast<std::time_t>(lastMs / 1000))) {
+            throw std::runtime_error("Failed to create partitions for the capture");
+        }
+
+        RowSource source(capture, policy);
+        setInfileSource(conn, source);
+        std::string query = std::string("LOAD DATA LOCAL INFILE 'capture' INTO TABLE `") + TABLE_NAME + "` (" +
+                            telemetryColumnList() + ")";
+
+        auto start = std::chrono::steady_clock::now();
+        do {
+            source.startLoad(rowsPerLoad);
+            if (mysql_query(conn, query.c_str())) {
+                throw std::runtime_error(std::string("LOAD DATA failed: ") + mysql_error(conn));
+            }
+            if (mysql_warning_count(conn) > 0) {
+                std::cerr << "LOAD DATA reported " << mysql_warning_count(conn) << " warnings" << std::endl;
+            }
+            std::cerr << "Loaded " << source.rows() << " rows" << std::endl;
+        } while (!source.finished());
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << source.messages() << " messages, " << source.rows() << " rows, "
+                  << source.errors() << " errors in " << seconds << " s ("
+                  << (seconds > 0 ? source.rows() / seconds : 0) << " rows/s)" << std::endl;
+        status = 0;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+
+    if (conn != NULL) {
+        mysql_close(conn);
+    }
+    Logger::instance().flush();
+    return status;
+}
@@ -0,0 +1,392 @@
+// restore: load archived day partitions back into laser_data
+//
+//   restore <archive folder> <from> [<to>] [--jobs N]
+//
+// <from> and <to> are local days, YYYY-MM-DD; <to> defaults to <from>. The
+// archives holding those days (partition PYYYYMMDD holds the day before
+// YYYYMMDD) are found in the YYYYMM folders retirement writes, as .lxc,
+// .csv.gz or the plain .csv older releases wrote. The YYYYMM.zip files those
+// releases also made are not read; unzip them into the folder first. Their
+// day partitions are recreated, then each archive is decompressed as it
+// streams into a table of its own with LOAD DATA LOCAL INFILE, on up to N
+// connections at once, and swapped into its empty partition with EXCHANGE
+// PARTITION. laser_data is only locked for the swap. A day is only split off
+// an existing partition while that partition is empty, so days before the
+// oldest partition still holding rows cannot be restored.
+
+#include "columnArchive.h"
+#include "dbConnection.h"
+#include "localInfile.h"
+#include "localTimeCache.h"
+#include "logger.h"
+#include "partitionMaintainer.h"
+#include <iostream>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+namespace {
+
+// Archives are restored into this table, the one retirement archives
+const char* const TABLE_NAME = "laser_data";
+// Each archive is loaded into a table of this name plus the partition name, then exchanged
+const char* const EXCHANGE_TABLE_PREFIX = "laser_data_restore_";
+const char* const CSV_ARCHIVE_EXTENSION = ".csv.gz";
+// Uncompressed CSV archive of older releases
+const char* const PLAIN_CSV_ARCHIVE_EXTENSION = ".csv";
+// Longest header line expected in a CSV archive
+constexpr int CSV_HEADER_MAX = 4096;
+
+void printUsage() {
+    std::cerr << "Usage: restore <archive folder> <from> [<to>] [--jobs N]\n"
+              << "  <from> and <to> are local days, YYYY-MM-DD\n"
+              << "  Archives are read as .lxc, .csv.gz or .csv; unzip YYYYMM.zip archives into the folder first"
+              << std::endl;
+}
+
+// Local midnight starting the day
+std::time_t parseDay(const std::string& text) {
+    std::tm day{};
+    if (std::sscanf(text.c_str(), "%d-%d-%d", &day.tm_year, &day.tm_mon, &day.tm_mday) != 3) {
+        throw std::runtime_error("Invalid day: " + text);
+    }
+    day.tm_year -= 1900;
+    day.tm_mon -= 1;
+    day.tm_isdst = -1;
+    std::time_t midnight = std::mktime(&day);
+    if (midnight == -1) {
+        throw std::runtime_error("Invalid day: " + text);
+    }
+    return midnight;
+}
+
+// Local midnight starting the next day
+std::time_t nextDay(std::time_t midnight) {
+    std::tm day;
+    localtime_r(&midnight, &day);
+    day.tm_mday += 1;
+    day.tm_hour = 0;
+    day.tm_min = 0;
+    day.tm_sec = 0;
+    day.tm_isdst = -1;
+    return std::mktime(&day);
+}
+
+bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+struct Archive {
+    std::string partition;
+    std::string path;
+    bool columnar;
+};
+
+// Archives of the partitions holding the days from firstDay to lastDay, one
+// per partition; a columnar archive is preferred over a CSV one
+std::vector<Archive> findArchives(const std::string& folder, std::time_t firstDay, std::time_t lastDay) {
+    namespace fs = std::filesystem;
+    std::time_t lastPartition = nextDay(lastDay);
+    std::map<std::time_t, Archive> found;
+    std::error_code error;
+    for (fs::recursive_directory_iterator it(folder, error), end; !error && it != end; it.increment(error)) {
+        if (!it->is_regular_file(error)) {
+            continue;
+        }
+        std::string name = it->path().filename().string();
+        bool columnar = endsWith(name, COLUMN_ARCHIVE_EXTENSION);
+        if (!columnar && !endsWith(name, CSV_ARCHIVE_EXTENSION) && !endsWith(name, PLAIN_CSV_ARCHIVE_EXTENSION)) {
+            continue;
+        }
+        std::string partition = name.substr(0, name.find('.'));
+        std::time_t date;
+        if (!parsePartitionDate(partition, date) || date <= firstDay || date > lastPartition) {
+            continue;
+        }
+        auto existing = found.find(date);
+        if (existing == found.end() || (columnar && !existing->second.columnar)) {
+            found[date] = Archive{partition, it->path().string(), columnar};
+        }
+    }
+    if (error) {
+        throw std::runtime_error("Failed to read " + folder + ": " + error.message());
+    }
+
+    std::vector<Archive> archives;
+    for (const auto& entry : found) {
+        archives.push_back(entry.second);
+    }
+    return archives;
+}
+
+// CSV archive as written by StorageManager::exportPartitionToCSV(), inflated as it
+// is read; gzread() passes a plain .csv through unchanged
+class CsvArchiveSource : public InfileSource {
+public:
+    explicit CsvArchiveSource(const std::string& path)
+        : m_file(gzopen(path.c_str(), "rb")) {
+        if (m_file == nullptr) {
+            throw std::runtime_error("Failed to open " + path);
+        }
+        gzbuffer(m_file, 256 * 1024);
+        char header[CSV_HEADER_MAX];
+        if (gzgets(m_file, header, sizeof(header)) == nullptr) {
+            gzclose(m_file);
+            throw std::runtime_error("Failed to read the header of " + path);
+        }
+        std::string line = header;
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+            line.pop_back();
+        }
+
+        // NULL was exported as an empty field, so every field goes through a
+        // variable and an empty one is stored as NULL
+        std::string variables;
+        std::string assignments;
+        size_t start = 0;
+        for (size_t i = 0; start <= line.size(); ++i) {
+            size_t end = std::min(line.find(',', start), line.size());
+            std::string variable = "@c" + std::to_string(i);
+            variables += (i > 0 ? ", " : "") + variable;
+            assignments += (i > 0 ? ", " : "") + line.substr(start, end - start) + " = NULLIF(" + variable + ", '')";
+            start = end + 1;
+        }
+        m_columns = "(" + variables + ") SET " + assignments;
+    }
+
+    ~CsvArchiveSource() override {
+        gzclose(m_file);
+    }
+
+    // Column list and assignments for LOAD DATA, from the header line
+    const std::string& columns() const { return m_columns; }
+
+    size_t read(char* buffer, size_t size) override {
+        int length = gzread(m_file, buffer, static_cast<unsigned int>(size));
+        if (length < 0) {
+            int code;
+            m_error = gzerror(m_file, &code);
+            return 0;
+        }
+        return static_cast<size_t>(length);
+    }
+
+    std::string error() const override { return m_error; }
+
+private:
+    gzFile m_file;
+    std::string m_columns;
+    std::string m_error;
+};
+
+// Columnar archive, decoded a block at a time into LOAD DATA's default text format
+class ColumnarArchiveSource : public InfileSource {
+public:
+    explicit ColumnarArchiveSource(const std::string& path)
+        : m_archive(path)
+        , m_nextBlock(0)
+        , m_textOffset(0) {
+        for (const auto& column : m_archive.columns()) {
+            m_columns += (m_columns.empty() ? "" : ", ") + column.name;
+        }
+    }
+
+    const std::string& columns() const { return m_columns; }
+
+    size_t read(char* buffer, size_t size) override {
+        try {
+            while (m_textOffset == m_text.size() && m_nextBlock < m_archive.blocks().size()) {
+                formatBlock(m_nextBlock++);
+            }
+        } catch (const std::exception& e) {
+            m_error = e.what();
+            return 0;
+        }
+        size_t length = std::min(size, m_text.size() - m_textOffset);
+        std::memcpy(buffer, m_text.data() + m_textOffset, length);
+        m_textOffset += length;
+        return length;
+    }
+
+    std::string error() const override { return m_error; }
+
+private:
+    void formatBlock(size_t block) {
+        m_archive.readBlock(block, {}, m_batch);
+        m_text.clear();
+        m_textOffset = 0;
+        char timestamp[32];
+        for (size_t row = 0; row < m_batch.rows; ++row) {
+            for (size_t c = 0; c < m_batch.columns.size(); ++c) {
+                const ColumnValues& values = m_batch.columns[c];
+                if (values.type == ColumnType::String) {
+                    appendInfileField(m_text, values.strings[row].data(), values.strings[row].size());
+                } else if (values.type == ColumnType::Timestamp) {
+                    m_text.append(timestamp, m_timeCache.format(values.numbers[row], timestamp, sizeof(timestamp)));
+                } else {
+                    appendInfileField(m_text, values.numbers[row]);
+                }
+                m_text += c + 1 < m_batch.columns.size() ? '\t' : '\n';
+            }
+        }
+    }
+
+    ColumnArchiveReader m_archive;
+    std::string m_columns;
+    size_t m_nextBlock;
+    ColumnBatch m_batch;
+    LocalTimeCache m_timeCache;
+    std::string m_text;             ///< Rows of the current block
+    size_t m_textOffset;
+    std::string m_error;
+};
+
+bool runQuery(MYSQL* conn, const std::string& query) {
+    if (mysql_query(conn, query.c_str())) {
+        LOG_ERROR("Query failed: " << mysql_error(conn) << " (" << query << ")");
+        return false;
+    }
+    return true;
+}
+
+// Load one archive into its exchange table and swap that into the empty partition
+bool restoreArchive(MYSQL* conn, const Archive& archive) {
+    // Rows already in the partition would be swapped out, so leave it alone
+    std::string probe = std::string("SELECT 1 FROM ") + TABLE_NAME + " PARTITION (" + archive.partition + ") LIMIT 1";
+    if (!runQuery(conn, probe)) {
+        return false;
+    }
+    MYSQL_RES* result = mysql_store_result(conn);
+    bool occupied = result != nullptr && mysql_num_rows(result) > 0;
+    if (result != nullptr) {
+        mysql_free_result(result);
+    }
+    if (occupied) {
+        LOG_WARNING("Partition " << archive.partition << " already holds rows, not restoring " << archive.path);
+        return false;
+    }
+
+    std::string exchangeTable = EXCHANGE_TABLE_PREFIX + archive.partition;
+    std::transform(exchangeTable.begin(), exchangeTable.end(), exchangeTable.begin(), ::tolower);
+    if (!runQuery(conn, "DROP TABLE IF EXISTS " + exchangeTable) ||
+        !runQuery(conn, "CREATE TABLE " + exchangeTable + " LIKE " + TABLE_NAME) ||
+        !runQuery(conn, "ALTER TABLE " + exchangeTable + " REMOVE PARTITIONING")) {
+        return false;
+    }
+
+    bool loaded;
+    try {
+        // CSV archives hold the server's own text; a backslash in them is not an escape
+        std::string load = "LOAD DATA LOCAL INFILE 'archive' INTO TABLE " + exchangeTable;
+        if (archive.columnar) {
+            ColumnarArchiveSource source(archive.path);
+            setInfileSource(conn, source);
+            loaded = runQuery(conn, load + " (" + source.columns() + ")");
+        } else {
+            CsvArchiveSource source(archive.path);
+            setInfileSource(conn, source);
+            loaded = runQuery(conn, load + " FIELDS TERMINATED BY ',' ESCAPED BY '' " + source.columns());
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR("Failed to read " << archive.path << ": " << e.what());
+        loaded = false;
+    }
+
+    bool restored = loaded && runQuery(conn, std::string("ALTER TABLE ") + TABLE_NAME + " EXCHANGE PARTITION " +
+                                                 archive.partition + " WITH TABLE " + exchangeTable);
+    runQuery(conn, "DROP TABLE IF EXISTS " + exchangeTable);
+    return restored;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printUsage();
+        return 1;
+    }
+
+    std::string folder = argv[1];
+    size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> days;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--jobs" && i + 1 < argc) {
+            jobs = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        } else if (days.size() < 2 && arg.rfind("--", 0) != 0) {
+            days.push_back(arg);
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    int status = 1;
+    MYSQL* conn = NULL;
+    try {
+        if (days.empty()) {
+            printUsage();
+            return 1;
+        }
+        std::time_t firstDay = parseDay(days[0]);
+        std::time_t lastDay = parseDay(days.size() > 1 ? days[1] : days[0]);
+        std::vector<Archive> archives = findArchives(folder, firstDay, lastDay);
+        if (archives.empty()) {
+            std::cerr << "No archives for " << days.front() << " to " << days.back() << " in " << folder << std::endl;
+            return 1;
+        }
+
+        conn = openInfileConnection(DbConfig());
+        if (conn == NULL || !createDayPartitions(conn, TABLE_NAME, firstDay, lastDay)) {
+            throw std::runtime_error("Failed to create the day partitions to restore into");
+        }
+
+        // Each worker restores whole archives on its own connection
+        auto start = std::chrono::steady_clock::now();
+        std::atomic<size_t> nextArchive(0);
+        std::atomic<size_t> restored(0);
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < std::min(jobs, archives.size()); ++i) {
+            workers.emplace_back([&] {
+                MYSQL* workerConn = openInfileConnection(DbConfig());
+                if (workerConn == NULL) {
+                    return;
+                }
+                for (size_t index = nextArchive++; index < archives.size(); index = nextArchive++) {
+                    if (restoreArchive(workerConn, archives[index])) {
+                        ++restored;
+                        LOG_INFO("Restored " << archives[index].partition << " from " << archives[index].path);
+                    }
+                }
+                mysql_close(workerConn);
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Restored " << restored << " of " << archives.size() << " partitions in " << seconds << " s"
+                  << std::endl;
+        status = restored == archives.size() ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+
+    if (conn != NULL) {
+        mysql_close(conn);
+    }
+    Logger::instance().flush();
+    return status;
+}
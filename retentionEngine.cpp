@@ -0,0 +1,354 @@
+#include "retentionEngine.h"
+#include "logger.h"
+#include "metrics.h"
+#include "partitionMaintainer.h"
+#include <sys/statvfs.h>
+#include <sys/stat.h>
+#include <filesystem>
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+// Time between passes, and after a failed one
+constexpr auto PASS_INTERVAL = std::chrono::minutes(10);
+constexpr auto RETRY_INTERVAL = std::chrono::minutes(5);
+// Usage is projected this far ahead at the current ingest rate
+constexpr double PROJECTION_SECONDS = 24 * 60 * 60;
+// Weight of the newest pass in the smoothed ingest rate and archive ratio
+constexpr double SMOOTHING = 0.3;
+// Archive size per byte of partition assumed until a retirement has been measured
+constexpr double DEFAULT_ARCHIVE_RATIO = 0.25;
+
+double mebibytes(double bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+// Total size of the regular files below path; unreadable entries are skipped
+uint64_t directorySize(const std::string& path) {
+    namespace fs = std::filesystem;
+    std::error_code error;
+    uint64_t bytes = 0;
+    fs::recursive_directory_iterator it(path, fs::directory_options::skip_permission_denied, error);
+    for (; !error && it != fs::recursive_directory_iterator(); it.increment(error)) {
+        std::error_code sizeError;
+        if (it->is_regular_file(sizeError)) {
+            uintmax_t size = it->file_size(sizeError);
+            if (!sizeError) {
+                bytes += size;
+            }
+        }
+    }
+    return bytes;
+}
+
+// Local midnight at the start of today
+std::time_t startOfToday() {
+    std::time_t now = std::time(nullptr);
+    std::tm localTime;
+    localtime_r(&now, &localTime);
+    localTime.tm_hour = 0;
+    localTime.tm_min = 0;
+    localTime.tm_sec = 0;
+    localTime.tm_isdst = -1;
+    return std::mktime(&localTime);
+}
+
+} // namespace
+
+RetentionEngine::RetentionEngine(const DbConfig& dbConfig, const std::string& tableName,
+                                 std::shared_ptr<StorageManager> storageManager, const std::string& archiveFolder)
+    : m_dbConfig(dbConfig)
+    , m_tableName(tableName)
+    , m_storageManager(std::move(storageManager))
+    , m_archiveFolder(archiveFolder)
+    , m_conn(NULL)
+    , m_maxStoragePercent(0)
+    , m_archiveOnDataFilesystem(true)
+    , m_archiveRatio(DEFAULT_ARCHIVE_RATIO)
+    , m_lastRowsInserted(0)
+    , m_ingestBytesPerSecond(-1)
+    , m_runRequested(true)
+    , m_reloadRequested(false)
+    , m_stopping(false) {
+    m_thread = std::thread(&RetentionEngine::run, this);
+}
+
+RetentionEngine::~RetentionEngine() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if (m_conn != NULL) {
+        mysql_close(m_conn);
+    }
+}
+
+void RetentionEngine::reloadSettings() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_reloadRequested = true;
+        m_runRequested = true;
+    }
+    m_wake.notify_one();
+}
+
+// Retention thread: a pass now, then every PASS_INTERVAL or on request
+void RetentionEngine::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping) {
+        bool reload = m_reloadRequested;
+        m_runRequested = false;
+        m_reloadRequested = false;
+        lock.unlock();
+
+        if (reload) {
+            m_settingsChecksum.clear();
+        }
+        bool succeeded = runOnce();
+
+        lock.lock();
+        m_wake.wait_for(lock, succeeded ? PASS_INTERVAL : RETRY_INTERVAL,
+                        [this] { return m_stopping || m_runRequested; });
+    }
+}
+
+bool RetentionEngine::runOnce() {
+    if (m_conn == NULL) {
+        m_conn = openConnection(m_dbConfig);
+        if (m_conn == NULL) {
+            return false;
+        }
+    }
+    if (!refreshSettings() || (m_datadir.empty() && !readDatadir())) {
+        return false;
+    }
+    if (m_maxStoragePercent <= 0) {
+        // Unset or unreadable; retiring against a zero limit would empty the database
+        LOG_WARNING("No storage limit in settings, retention skipped");
+        return true;
+    }
+
+    struct statvfs stat;
+    if (statvfs(m_datadir.c_str(), &stat) != 0) {
+        LOG_ERROR("Failed to get disk space information for " << m_datadir);
+        return false;
+    }
+    double totalBytes = static_cast<double>(stat.f_blocks) * stat.f_frsize;
+    double usedBytes = totalBytes - static_cast<double>(stat.f_bfree) * stat.f_frsize;
+    double limitBytes = totalBytes * m_maxStoragePercent / 100.0;
+
+    std::vector<Partition> partitions;
+    if (!readPartitions(partitions)) {
+        return false;
+    }
+    uint64_t databaseBytes = 0;
+    for (const auto& partition : partitions) {
+        databaseBytes += partition.bytes;
+    }
+
+    double ingestRate = ingestBytesPerSecond(partitions);
+    double projectedBytes = usedBytes + ingestRate * PROJECTION_SECONDS;
+
+    LOG_INFO("Storage: " << mebibytes(usedBytes) << " of " << mebibytes(totalBytes) << " MiB used, limit "
+             << mebibytes(limitBytes) << " MiB, " << m_tableName << " " << mebibytes(databaseBytes)
+             << " MiB in " << partitions.size() << " partitions, archives "
+             << mebibytes(directorySize(m_archiveFolder)) << " MiB, ingest "
+             << mebibytes(ingestRate * PROJECTION_SECONDS) << " MiB/day");
+
+    if (projectedBytes <= limitBytes) {
+        return true;
+    }
+
+    // Over the limit already: free all of the excess now. Otherwise one
+    // partition per pass keeps ahead of the projection.
+    uint64_t bytesToFree = 0;
+    if (usedBytes > limitBytes) {
+        double freedPerByte = m_archiveOnDataFilesystem ? 1.0 - m_archiveRatio : 1.0;
+        bytesToFree = static_cast<uint64_t>((projectedBytes - limitBytes) / std::max(freedPerByte, 0.1));
+    }
+    retire(partitions, bytesToFree);
+    return true;
+}
+
+// Read maxStorage again if the settings table changed since it was last read
+bool RetentionEngine::refreshSettings() {
+    if (mysql_query(m_conn, "CHECKSUM TABLE settings")) {
+        LOG_ERROR("Failed to check settings: " << mysql_error(m_conn));
+        mysql_close(m_conn);
+        m_conn = NULL;
+        return false;
+    }
+    MYSQL_RES* result = mysql_store_result(m_conn);
+    if (result == NULL) {
+        LOG_ERROR("Failed to store result: " << mysql_error(m_conn));
+        return false;
+    }
+    MYSQL_ROW row = mysql_fetch_row(result);
+    std::string checksum = (row != NULL && row[1] != NULL) ? row[1] : "";
+    mysql_free_result(result);
+
+    if (!checksum.empty() && checksum == m_settingsChecksum) {
+        return true;
+    }
+
+    if (mysql_query(m_conn, "SELECT maxStorage FROM settings WHERE id = 1;")) {
+        LOG_ERROR("SELECT failed: " << mysql_error(m_conn));
+        return false;
+    }
+    result = mysql_store_result(m_conn);
+    if (result == NULL) {
+        LOG_ERROR("Failed to store result from SELECT query");
+        return false;
+    }
+    row = mysql_fetch_row(result);
+    double maxStorage = (row != NULL && row[0] != NULL) ? std::strtod(row[0], nullptr) : 0.0;
+    mysql_free_result(result);
+
+    if (maxStorage != m_maxStoragePercent) {
+        LOG_INFO("Max Storage: " << maxStorage << "%");
+    }
+    m_maxStoragePercent = maxStorage;
+    m_settingsChecksum = checksum;
+    return true;
+}
+
+// Find the server's data directory, and whether archives share its filesystem
+bool RetentionEngine::readDatadir() {
+    if (mysql_query(m_conn, "SELECT @@datadir;")) {
+        LOG_ERROR("SELECT failed: " << mysql_error(m_conn));
+        return false;
+    }
+    MYSQL_RES* result = mysql_store_result(m_conn);
+    if (result == NULL) {
+        LOG_ERROR("Failed to store result from SELECT query");
+        return false;
+    }
+    MYSQL_ROW row = mysql_fetch_row(result);
+    if (row != NULL && row[0] != NULL) {
+        m_datadir = row[0];
+    }
+    mysql_free_result(result);
+    if (m_datadir.empty()) {
+        LOG_ERROR("Server reported no datadir");
+        return false;
+    }
+
+    struct stat dataStat;
+    struct stat archiveStat;
+    if (stat(m_datadir.c_str(), &dataStat) == 0 && stat(m_archiveFolder.c_str(), &archiveStat) == 0) {
+        m_archiveOnDataFilesystem = dataStat.st_dev == archiveStat.st_dev;
+    }
+    LOG_INFO("Database files in " << m_datadir << ", archives in " << m_archiveFolder
+             << (m_archiveOnDataFilesystem ? " on the same filesystem" : " on another filesystem"));
+    return true;
+}
+
+// Size of every day partition of the table, oldest first
+bool RetentionEngine::readPartitions(std::vector<Partition>& partitions) {
+    std::string query = "SELECT partition_name, data_length + index_length, table_rows "
+                        "FROM information_schema.partitions "
+                        "WHERE table_schema = DATABASE() AND table_name = '" + m_tableName + "' "
+                        "AND partition_name IS NOT NULL";
+    if (mysql_query(m_conn, query.c_str())) {
+        LOG_ERROR("Failed to fetch partition sizes: " << mysql_error(m_conn));
+        return false;
+    }
+    MYSQL_RES* result = mysql_store_result(m_conn);
+    if (result == NULL) {
+        LOG_ERROR("Failed to store result: " << mysql_error(m_conn));
+        return false;
+    }
+
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result))) {
+        Partition partition;
+        if (row[0] == NULL || !parsePartitionDate(row[0], partition.date)) {
+            continue;
+        }
+        partition.name = row[0];
+        partition.bytes = row[1] != NULL ? std::strtoull(row[1], nullptr, 10) : 0;
+        partition.rows = row[2] != NULL ? std::strtoull(row[2], nullptr, 10) : 0;
+        partitions.push_back(partition);
+    }
+    mysql_free_result(result);
+
+    std::sort(partitions.begin(), partitions.end(),
+              [](const Partition& a, const Partition& b) { return a.date < b.date; });
+    return true;
+}
+
+// Bytes the table grows by per second: rows inserted since the last pass
+// times the average row size on disk. The first estimate is the size of
+// yesterday's partition spread over the day.
+double RetentionEngine::ingestBytesPerSecond(const std::vector<Partition>& partitions) {
+    uint64_t bytes = 0;
+    uint64_t rows = 0;
+    for (const auto& partition : partitions) {
+        bytes += partition.bytes;
+        rows += partition.rows;
+    }
+    double bytesPerRow = rows > 0 ? static_cast<double>(bytes) / rows : 0.0;
+
+    auto now = std::chrono::steady_clock::now();
+    uint64_t rowsInserted = pipelineMetrics().rowsInserted.value();
+
+    if (m_ingestBytesPerSecond < 0) {
+        std::time_t today = startOfToday();
+        m_ingestBytesPerSecond = 0;
+        for (const auto& partition : partitions) {
+            if (partition.date == today) {
+                m_ingestBytesPerSecond = partition.bytes / PROJECTION_SECONDS;
+            }
+        }
+    } else {
+        double elapsed = std::chrono::duration<double>(now - m_lastPass).count();
+        if (elapsed > 0) {
+            double rate = (rowsInserted - m_lastRowsInserted) * bytesPerRow / elapsed;
+            m_ingestBytesPerSecond += SMOOTHING * (rate - m_ingestBytesPerSecond);
+        }
+    }
+
+    m_lastRowsInserted = rowsInserted;
+    m_lastPass = now;
+    return m_ingestBytesPerSecond;
+}
+
+// Archive and drop the oldest partitions holding only days before today:
+// one, or as many as it takes to free bytesToFree
+void RetentionEngine::retire(const std::vector<Partition>& partitions, uint64_t bytesToFree) {
+    std::time_t today = startOfToday();
+    std::vector<std::string> names;
+    uint64_t retiredBytes = 0;
+    for (const auto& partition : partitions) {
+        if (partition.date > today || (!names.empty() && retiredBytes >= bytesToFree)) {
+            break;
+        }
+        names.push_back(partition.name);
+        retiredBytes += partition.bytes;
+    }
+    if (names.empty()) {
+        LOG_WARNING("Storage limit will be reached, but no partition before today is left to retire");
+        return;
+    }
+
+    LOG_INFO("Retiring " << names.size() << " partitions from " << names.front() << ", "
+             << mebibytes(retiredBytes) << " MiB");
+    uint64_t archiveBefore = directorySize(m_archiveFolder);
+    try {
+        m_storageManager->archivePartitions(names, m_archiveFolder);
+    } catch (const std::exception& e) {
+        LOG_ERROR("Failed to retire partitions: " << e.what());
+        return;
+    }
+
+    uint64_t archiveAfter = directorySize(m_archiveFolder);
+    if (retiredBytes > 0 && archiveAfter >= archiveBefore) {
+        double ratio = static_cast<double>(archiveAfter - archiveBefore) / retiredBytes;
+        m_archiveRatio += SMOOTHING * (std::min(ratio, 1.0) - m_archiveRatio);
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef RETENTION_ENGINE_H
+#define RETENTION_ENGINE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <ctime>
+#include <mariadb/mysql.h>
+#include "dbConnection.h"
+#include "storageManager.h"
+
+// Keeps the filesystem holding the database below the maxStorage share set
+// in the settings table. Every pass measures the filesystem of the server's
+// datadir, the size of every day partition (information_schema) and the
+// archive folder, and projects usage a day ahead from the current ingest
+// rate. When the projection crosses the limit the oldest day partition is
+// archived and dropped, one per pass, so space is freed a little at a time
+// well before the limit. Only if usage is already over the limit are as
+// many partitions retired at once as it takes to get back under it.
+//
+// Settings are cached and only read again when the settings table's
+// checksum changes, or after reloadSettings().
+class RetentionEngine {
+public:
+    RetentionEngine(const DbConfig& dbConfig, const std::string& tableName,
+                    std::shared_ptr<StorageManager> storageManager, const std::string& archiveFolder);
+    ~RetentionEngine();
+
+    RetentionEngine(const RetentionEngine&) = delete;
+    RetentionEngine& operator=(const RetentionEngine&) = delete;
+
+    // Read the settings table again and run a pass now
+    void reloadSettings();
+
+private:
+    struct Partition {
+        std::string name;
+        std::time_t date;       ///< Rows in the partition are before this local midnight
+        uint64_t bytes;         ///< Data and index
+        uint64_t rows;          ///< Estimate from information_schema
+    };
+
+    void run();
+    bool runOnce();
+    bool refreshSettings();
+    bool readDatadir();
+    bool readPartitions(std::vector<Partition>& partitions);
+    double ingestBytesPerSecond(const std::vector<Partition>& partitions);
+    void retire(const std::vector<Partition>& partitions, uint64_t bytesToFree);
+
+    DbConfig m_dbConfig;
+    std::string m_tableName;
+    std::shared_ptr<StorageManager> m_storageManager;
+    std::string m_archiveFolder;
+    MYSQL* m_conn;
+
+    // Cached settings and the checksum of the settings table they were read at
+    std::string m_settingsChecksum;
+    double m_maxStoragePercent;
+
+    std::string m_datadir;
+    bool m_archiveOnDataFilesystem;
+    // Archive bytes written per byte of partition retired, measured on every retirement
+    double m_archiveRatio;
+
+    // Ingest rate, smoothed over passes
+    uint64_t m_lastRowsInserted;
+    std::chrono::steady_clock::time_point m_lastPass;
+    double m_ingestBytesPerSecond;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_runRequested;
+    bool m_reloadRequested;
+    bool m_stopping;
+};
+
+#endif // RETENTION_ENGINE_H
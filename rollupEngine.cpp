@@ -0,0 +1,421 @@
+#include "rollupEngine.h"
+#include "logger.h"
+#include "metrics.h"
+#include <sstream>
+#include <type_traits>
+#include <algorithm>
+#include <ctime>
+#include <cstring>
+
+namespace {
+
+constexpr uint64_t MINUTE_MS = 60 * 1000;
+constexpr uint64_t HOUR_MS = 60 * MINUTE_MS;
+// Closed buckets waiting for the writer thread
+constexpr size_t CLOSED_QUEUE_CAPACITY = 1024;
+// Buckets kept while the database is unavailable (about a week of minutes and hours)
+constexpr size_t MAX_PENDING_BUCKETS = 12 * 1024;
+// How often the writer thread looks for closed buckets
+constexpr auto WRITER_POLL_INTERVAL = std::chrono::seconds(1);
+// Wait between attempts to hand over the final buckets on shutdown
+constexpr auto SHUTDOWN_PUSH_INTERVAL = std::chrono::milliseconds(10);
+// Wait before trying the database again after a failure
+constexpr auto RETRY_INTERVAL = std::chrono::seconds(30);
+// A bucket the server has refused this often is dropped
+constexpr uint8_t ROLLUP_MAX_ATTEMPTS = 3;
+
+// (index in TELEMETRY_FIELDS, name) of every numeric field except the device's serialNumber
+std::vector<std::pair<size_t, const char*>> numericFields() {
+    std::vector<std::pair<size_t, const char*>> fields;
+    size_t index = 0;
+#define ROLLUP_NUMERIC_FIELD(command, name, type) \
+    if (std::is_same<type, uint32_t>::value && std::strcmp(#name, "serialNumber") != 0) { \
+        fields.push_back({index, #name}); \
+    } \
+    ++index;
+    TELEMETRY_FIELDS(ROLLUP_NUMERIC_FIELD)
+#undef ROLLUP_NUMERIC_FIELD
+    return fields;
+}
+
+template <typename Aggregate>
+void addSample(bool carried, Aggregate& aggregate, uint32_t value) {
+    if (!carried) {
+        return;
+    }
+    if (value < aggregate.min) {
+        aggregate.min = value;
+    }
+    if (value > aggregate.max) {
+        aggregate.max = value;
+    }
+    aggregate.sum += value;
+    ++aggregate.count;
+}
+
+// String fields are not aggregated
+template <typename Aggregate>
+void addSample(bool, Aggregate&, const TelemetryString&) {}
+
+} // namespace
+
+std::vector<std::string> rollupTableNames(const std::string& tableName) {
+    return {tableName + "_minute", tableName + "_hour"};
+}
+
+RollupEngine::RollupEngine(const DbConfig& dbConfig, const std::string& tableName, int partitionDaysAhead)
+    : m_dbConfig(dbConfig)
+    , m_tables(rollupTableNames(tableName))
+    , m_partitionDaysAhead(partitionDaysAhead)
+    , m_closed(CLOSED_QUEUE_CAPACITY)
+    , m_conn(NULL)
+    , m_tablesReady(false)
+    , m_nextAttempt(std::chrono::steady_clock::now())
+    , m_running(true) {
+    m_thread = std::thread(&RollupEngine::run, this);
+}
+
+RollupEngine::~RollupEngine() {
+    // The receive thread is done by now; hand over the partial buckets so
+    // they are not lost, waiting for the writer thread whenever the queue is full
+    auto push = [this](Level level, const Bucket& bucket) {
+        while (!m_closed.tryPush(ClosedBucket{level, bucket})) {
+            std::this_thread::sleep_for(SHUTDOWN_PUSH_INTERVAL);
+        }
+    };
+    for (auto& device : m_open) {
+        auto& open = device.second;
+        push(Minute, open[Minute]);
+        mergeBucket(open[Hour], open[Minute]);
+        push(Hour, open[Hour]);
+    }
+
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    m_maintainers.clear();
+    if (m_conn != NULL) {
+        mysql_close(m_conn);
+    }
+}
+
+void RollupEngine::resetBucket(Bucket& bucket, uint32_t serialNumber, uint64_t startMs) {
+    bucket.serialNumber = serialNumber;
+    bucket.startMs = startMs;
+    for (auto& field : bucket.fields) {
+        field.min = UINT32_MAX;
+        field.max = 0;
+        field.sum = 0;
+        field.count = 0;
+    }
+}
+
+void RollupEngine::mergeBucket(Bucket& into, const Bucket& from) {
+    for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; ++i) {
+        const FieldAggregate& source = from.fields[i];
+        if (source.count == 0) {
+            continue;
+        }
+        FieldAggregate& target = into.fields[i];
+        target.min = std::min(target.min, source.min);
+        target.max = std::max(target.max, source.max);
+        target.sum += source.sum;
+        target.count += source.count;
+    }
+}
+
+// The receive thread must not wait for the database, so a bucket that does not fit is dropped
+void RollupEngine::closeBucket(Level level, const Bucket& bucket) {
+    if (!m_closed.tryPush(ClosedBucket{level, bucket})) {
+        pipelineMetrics().rollupBucketsDropped.add();
+        LOG_ERROR_LIMITED("Rollup queue full, dropping " << (level == Minute ? "minute" : "hour")
+                          << " bucket of device " << bucket.serialNumber);
+    }
+}
+
+void RollupEngine::record(uint16_t commandID, const Snapshot& current) {
+    uint64_t minuteStart = current.timestampMs - current.timestampMs % MINUTE_MS;
+    uint64_t hourStart = minuteStart - minuteStart % HOUR_MS;
+
+    uint32_t device = current.serialNumber;
+    auto found = m_open.find(device);
+    if (found == m_open.end()) {
+        found = m_open.emplace(device, std::array<Bucket, LevelCount>()).first;
+        resetBucket(found->second[Minute], device, minuteStart);
+        resetBucket(found->second[Hour], device, hourStart);
+    }
+    auto& open = found->second;
+
+    Bucket* target = &open[Minute];
+    Bucket late;
+    if (minuteStart > open[Minute].startMs) {
+        // The open minute is complete; fold it into its hour before moving on
+        closeBucket(Minute, open[Minute]);
+        mergeBucket(open[Hour], open[Minute]);
+        if (hourStart > open[Hour].startMs) {
+            closeBucket(Hour, open[Hour]);
+            resetBucket(open[Hour], device, hourStart);
+        }
+        resetBucket(open[Minute], device, minuteStart);
+    } else if (minuteStart < open[Minute].startMs) {
+        // Late message for a minute already written; the upsert merges it in
+        resetBucket(late, device, minuteStart);
+        target = &late;
+    }
+
+    size_t field = 0;
+#define ROLLUP_RECORD_FIELD(command, name, type) \
+    addSample(command == commandID, target->fields[field], current.name); \
+    ++field;
+    TELEMETRY_FIELDS(ROLLUP_RECORD_FIELD)
+#undef ROLLUP_RECORD_FIELD
+
+    if (target == &late) {
+        closeBucket(Minute, late);
+        if (hourStart == open[Hour].startMs) {
+            mergeBucket(open[Hour], late);
+        } else {
+            late.startMs = hourStart;
+            closeBucket(Hour, late);
+        }
+    }
+}
+
+// Writer thread: collect closed buckets and write them, retrying after failures
+void RollupEngine::run() {
+    ClosedBucket closed;
+    while (true) {
+        bool stopping = !m_running.load();
+
+        while (m_closed.tryPop(closed)) {
+            m_pending.push_back(closed);
+        }
+        if (m_pending.size() > MAX_PENDING_BUCKETS) {
+            size_t excess = m_pending.size() - MAX_PENDING_BUCKETS;
+            pipelineMetrics().rollupBucketsDropped.add(excess);
+            LOG_ERROR("Rollup backlog full, dropping " << excess << " oldest buckets");
+            m_pending.erase(m_pending.begin(), m_pending.begin() + excess);
+        }
+
+        if (std::chrono::steady_clock::now() >= m_nextAttempt || stopping) {
+            bool succeeded = connect() && createTables() && writeBuckets();
+            if (!succeeded) {
+                m_nextAttempt = std::chrono::steady_clock::now() + RETRY_INTERVAL;
+            }
+        }
+
+        if (stopping) {
+            break;
+        }
+        std::this_thread::sleep_for(WRITER_POLL_INTERVAL);
+    }
+}
+
+bool RollupEngine::connect() {
+    if (m_conn == NULL) {
+        m_conn = openConnection(m_dbConfig);
+    }
+    return m_conn != NULL;
+}
+
+// Create the rollup tables if needed, then keep their day partitions maintained
+bool RollupEngine::createTables() {
+    if (m_tablesReady) {
+        return true;
+    }
+
+    // The first partition holds today; the maintainer adds the days after it
+    std::time_t now = std::time(nullptr);
+    std::tm tomorrow;
+    localtime_r(&now, &tomorrow);
+    tomorrow.tm_mday += 1;
+    tomorrow.tm_hour = 0;
+    tomorrow.tm_min = 0;
+    tomorrow.tm_sec = 0;
+    tomorrow.tm_isdst = -1;
+    std::mktime(&tomorrow);
+    char partitionName[20];
+    std::strftime(partitionName, sizeof(partitionName), "P%Y%m%d", &tomorrow);
+    char boundary[32];
+    std::strftime(boundary, sizeof(boundary), "%Y-%m-%d 00:00:00", &tomorrow);
+
+    for (const auto& table : m_tables) {
+        std::stringstream query;
+        query << "CREATE TABLE IF NOT EXISTS " << table
+              << " (serialNumber INT UNSIGNED NOT NULL DEFAULT 0, bucket DATETIME NOT NULL";
+        for (const auto& field : numericFields()) {
+            query << ", " << field.second << "_min INT UNSIGNED NULL"
+                  << ", " << field.second << "_max INT UNSIGNED NULL"
+                  << ", " << field.second << "_sum BIGINT UNSIGNED NOT NULL DEFAULT 0"
+                  << ", " << field.second << "_count INT UNSIGNED NOT NULL DEFAULT 0";
+        }
+        query << ", PRIMARY KEY (serialNumber, bucket)) PARTITION BY RANGE COLUMNS(bucket) (PARTITION " << partitionName
+              << " VALUES LESS THAN ('" << boundary << "'));";
+
+        if (mysql_query(m_conn, query.str().c_str())) {
+            LOG_ERROR("Failed to create rollup table " << table << ": " << mysql_error(m_conn));
+            mysql_close(m_conn);
+            m_conn = NULL;
+            return false;
+        }
+        if (!addDeviceColumn(table)) {
+            return false;
+        }
+    }
+
+    for (const auto& table : m_tables) {
+        m_maintainers.push_back(std::make_unique<PartitionMaintainer>(m_dbConfig, table, m_partitionDaysAhead,
+                                                                      nullptr));
+    }
+    m_tablesReady = true;
+    return true;
+}
+
+// Tables created before rollups were kept per device get the serialNumber column;
+// their existing rows are attributed to serial 0
+bool RollupEngine::addDeviceColumn(const std::string& table) {
+    std::string query = "SELECT COUNT(*) FROM information_schema.columns WHERE table_schema = DATABASE() "
+                        "AND table_name = '" + table + "' AND column_name = 'serialNumber';";
+    bool present = false;
+    if (mysql_query(m_conn, query.c_str()) == 0) {
+        MYSQL_RES* result = mysql_store_result(m_conn);
+        if (result != NULL) {
+            MYSQL_ROW row = mysql_fetch_row(result);
+            present = row != NULL && row[0] != NULL && std::strcmp(row[0], "0") != 0;
+            mysql_free_result(result);
+        }
+    }
+    if (present) {
+        return true;
+    }
+
+    query = "ALTER TABLE " + table + " ADD COLUMN serialNumber INT UNSIGNED NOT NULL DEFAULT 0 FIRST, "
+            "DROP PRIMARY KEY, ADD PRIMARY KEY (serialNumber, bucket);";
+    if (mysql_query(m_conn, query.c_str())) {
+        LOG_ERROR("Failed to add serialNumber to rollup table " << table << ": " << mysql_error(m_conn));
+        mysql_close(m_conn);
+        m_conn = NULL;
+        return false;
+    }
+    LOG_INFO("Rollup table " << table << " now keyed by serialNumber");
+    return true;
+}
+
+// Upsert the given pending buckets of one level in a single statement.
+// Returns false with the error left on m_conn if the server refuses it.
+bool RollupEngine::upsertBuckets(Level level, const std::vector<size_t>& indices) {
+    const auto fields = numericFields();
+    std::stringstream query;
+    query << "INSERT INTO " << m_tables[level] << " (serialNumber, bucket";
+    for (const auto& field : fields) {
+        query << ", " << field.second << "_min, " << field.second << "_max, "
+              << field.second << "_sum, " << field.second << "_count";
+    }
+    query << ") VALUES ";
+
+    size_t rows = 0;
+    for (size_t index : indices) {
+        const Bucket& bucket = m_pending[index].bucket;
+        char bucketTime[32];
+        if (m_timeCache.format(bucket.startMs, bucketTime, sizeof(bucketTime)) == 0) {
+            continue;
+        }
+        query << (rows++ > 0 ? ", (" : "(") << bucket.serialNumber << ", '" << bucketTime << "'";
+        for (const auto& field : fields) {
+            const FieldAggregate& aggregate = bucket.fields[field.first];
+            if (aggregate.count > 0) {
+                query << ", " << aggregate.min << ", " << aggregate.max;
+            } else {
+                query << ", NULL, NULL";
+            }
+            query << ", " << aggregate.sum << ", " << aggregate.count;
+        }
+        query << ")";
+    }
+    if (rows == 0) {
+        return true;
+    }
+
+    // Merge with a bucket already written, e.g. before a restart
+    query << " ON DUPLICATE KEY UPDATE ";
+    for (size_t i = 0; i < fields.size(); ++i) {
+        std::string name = fields[i].second;
+        query << (i > 0 ? ", " : "")
+              << name << "_min = LEAST(COALESCE(" << name << "_min, VALUES(" << name << "_min)), COALESCE(VALUES("
+              << name << "_min), " << name << "_min)), "
+              << name << "_max = GREATEST(COALESCE(" << name << "_max, VALUES(" << name << "_max)), COALESCE(VALUES("
+              << name << "_max), " << name << "_max)), "
+              << name << "_sum = " << name << "_sum + VALUES(" << name << "_sum), "
+              << name << "_count = " << name << "_count + VALUES(" << name << "_count)";
+    }
+    return mysql_query(m_conn, query.str().c_str()) == 0;
+}
+
+// Upsert every pending bucket, one statement per level. If the server
+// refuses a statement, e.g. for a bucket past the last partition, the level
+// is retried a bucket at a time so the others still get written; a bucket
+// refused ROLLUP_MAX_ATTEMPTS times is dropped. Returns false while buckets
+// are left to retry.
+bool RollupEngine::writeBuckets() {
+    if (m_pending.empty()) {
+        return true;
+    }
+
+    std::vector<bool> done(m_pending.size(), false);
+    bool lost = false;
+    for (int level = 0; level < LevelCount && !lost; ++level) {
+        std::vector<size_t> indices;
+        for (size_t i = 0; i < m_pending.size(); ++i) {
+            if (m_pending[i].level == level) {
+                indices.push_back(i);
+            }
+        }
+        if (indices.empty()) {
+            continue;
+        }
+
+        if (upsertBuckets(static_cast<Level>(level), indices)) {
+            for (size_t index : indices) {
+                done[index] = true;
+            }
+            continue;
+        }
+        LOG_ERROR("Failed to write " << indices.size() << " rollup rows to " << m_tables[level] << ": "
+                  << mysql_error(m_conn));
+        if (connectionLost(mysql_errno(m_conn))) {
+            lost = true;
+            break;
+        }
+
+        for (size_t index : indices) {
+            ClosedBucket& closed = m_pending[index];
+            if (upsertBuckets(static_cast<Level>(level), {index})) {
+                done[index] = true;
+            } else if (connectionLost(mysql_errno(m_conn))) {
+                lost = true;
+                break;
+            } else if (++closed.attempts >= ROLLUP_MAX_ATTEMPTS) {
+                pipelineMetrics().rollupBucketsDropped.add();
+                LOG_ERROR("Dropping " << (level == Minute ? "minute" : "hour") << " bucket of device "
+                          << closed.bucket.serialNumber << " rejected " << closed.attempts << " times: "
+                          << mysql_error(m_conn));
+                done[index] = true;
+            }
+        }
+    }
+
+    std::vector<ClosedBucket> remaining;
+    for (size_t i = 0; i < m_pending.size(); ++i) {
+        if (!done[i]) {
+            remaining.push_back(m_pending[i]);
+        }
+    }
+    m_pending.swap(remaining);
+
+    if (lost) {
+        mysql_close(m_conn);
+        m_conn = NULL;
+    }
+    return m_pending.empty();
+}
@@ -0,0 +1,97 @@
+#ifndef ROLLUP_ENGINE_H
+#define ROLLUP_ENGINE_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mariadb/mysql.h>
+#include "snapshot.h"
+#include "spscQueue.h"
+#include "dbConnection.h"
+#include "partitionMaintainer.h"
+#include "localTimeCache.h"
+
+// Rollup tables kept next to a raw table: <table>_minute and <table>_hour
+std::vector<std::string> rollupTableNames(const std::string& tableName);
+
+// Keeps min/max/sum/count of every numeric telemetry field per device
+// (serialNumber), minute and hour as messages arrive, and writes each bucket
+// once it closes. The
+// average is sum / count. Buckets are upserted, so a bucket written twice
+// (late messages, a restart part-way through a minute) is merged rather
+// than duplicated.
+//
+// record() runs on the receive thread and only touches memory; closed
+// buckets are handed to a background thread with its own connection.
+class RollupEngine {
+public:
+    RollupEngine(const DbConfig& dbConfig, const std::string& tableName, int partitionDaysAhead);
+    ~RollupEngine();
+
+    RollupEngine(const RollupEngine&) = delete;
+    RollupEngine& operator=(const RollupEngine&) = delete;
+
+    // Add the fields carried by one message, using current.serialNumber and current.timestampMs
+    void record(uint16_t commandID, const Snapshot& current);
+
+private:
+    struct FieldAggregate {
+        uint32_t min;
+        uint32_t max;
+        uint64_t sum;
+        uint32_t count;
+    };
+
+    // Indexed like TELEMETRY_FIELDS; string fields and serialNumber stay empty
+    struct Bucket {
+        uint32_t serialNumber;
+        uint64_t startMs;
+        FieldAggregate fields[TELEMETRY_FIELD_COUNT];
+    };
+
+    enum Level : uint8_t { Minute = 0, Hour = 1, LevelCount = 2 };
+
+    struct ClosedBucket {
+        Level level;
+        Bucket bucket;
+        uint8_t attempts = 0;   ///< Times the server has refused this bucket on its own
+    };
+
+    static void resetBucket(Bucket& bucket, uint32_t serialNumber, uint64_t startMs);
+    static void mergeBucket(Bucket& into, const Bucket& from);
+    void closeBucket(Level level, const Bucket& bucket);
+
+    void run();
+    bool connect();
+    bool createTables();
+    bool addDeviceColumn(const std::string& table);
+    bool upsertBuckets(Level level, const std::vector<size_t>& indices);
+    bool writeBuckets();
+
+    DbConfig m_dbConfig;
+    std::vector<std::string> m_tables;      ///< Indexed by Level
+    int m_partitionDaysAhead;
+    std::vector<std::unique_ptr<PartitionMaintainer>> m_maintainers;   ///< Started once the tables exist
+
+    // Receive-thread state: the open minute and hour of every device
+    std::unordered_map<uint32_t, std::array<Bucket, LevelCount>> m_open;
+
+    // Receive thread -> writer thread
+    SpscQueue<ClosedBucket> m_closed;
+
+    // Writer-thread state
+    MYSQL* m_conn;
+    bool m_tablesReady;
+    std::vector<ClosedBucket> m_pending;    ///< Taken from m_closed, not yet written
+    std::chrono::steady_clock::time_point m_nextAttempt;
+    LocalTimeCache m_timeCache;
+    std::thread m_thread;
+    std::atomic<bool> m_running;
+};
+
+#endif // ROLLUP_ENGINE_H
@@ -0,0 +1,17 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+#include "telemetrySchema.h"
+
+// One row of laser_data: the latest value of every field at the time the row
+// was captured. Plain data with fixed-size strings so rows can be copied into
+// batches without touching the heap. Members follow TELEMETRY_FIELDS.
+struct Snapshot {
+#define SNAPSHOT_MEMBER(command, name, type) type name;
+    TELEMETRY_FIELDS(SNAPSHOT_MEMBER)
+#undef SNAPSHOT_MEMBER
+    uint64_t timestampMs;     ///< Publisher timestamp, epoch milliseconds
+};
+
+#endif // SNAPSHOT_H
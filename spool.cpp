@@ -0,0 +1,204 @@
+#include "spool.h"
+#include "logger.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+namespace {
+constexpr char SPOOL_MAGIC[8] = {'L', 'U', 'X', 'S', 'P', 'L', '0', '1'};
+// Records start on the page after the header
+constexpr size_t HEADER_SIZE = 4096;
+}
+
+struct Spool::Header {
+    char magic[8];
+    uint32_t recordSize;        ///< sizeof(Record) of the writer; a schema change invalidates the file
+    uint32_t reserved;
+    uint64_t capacity;
+    uint64_t head;              ///< Oldest row not yet replayed
+    uint64_t tail;              ///< Next row to write
+};
+
+struct Spool::Record {
+    uint32_t checksum;          ///< crc32 of data
+    uint32_t reserved;
+    Snapshot data;
+};
+
+// Rows are stored as raw bytes
+static_assert(std::is_trivially_copyable<Snapshot>::value, "Snapshot must be trivially copyable");
+
+namespace {
+uint32_t recordChecksum(const Snapshot& data) {
+    return static_cast<uint32_t>(crc32(0L, reinterpret_cast<const Bytef*>(&data), sizeof(data)));
+}
+}
+
+Spool::Spool(const std::string& path, size_t capacityRows)
+    : m_path(path)
+    , m_fd(-1)
+    , m_capacity(capacityRows > 0 ? capacityRows : 1)
+    , m_mappedSize(0)
+    , m_header(nullptr)
+    , m_records(nullptr)
+    , m_peekEnd(0)
+    , m_dropped(0)
+    , m_corrupt(0)
+    , m_dirty(false)
+    , m_lastSync(std::chrono::steady_clock::now()) {
+    static_assert(sizeof(Header) <= HEADER_SIZE, "Spool header must fit its page");
+
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd == -1) {
+        throw std::runtime_error("Failed to open spool: " + path);
+    }
+
+    // Keep an existing spool if it was written with the same row layout
+    Header existing{};
+    bool reuse = false;
+    struct stat info;
+    if (::fstat(m_fd, &info) == 0 && info.st_size > 0) {
+        bool valid = ::pread(m_fd, &existing, sizeof(existing), 0) == static_cast<ssize_t>(sizeof(existing)) &&
+                     std::memcmp(existing.magic, SPOOL_MAGIC, sizeof(SPOOL_MAGIC)) == 0 &&
+                     existing.recordSize == sizeof(Record) &&
+                     existing.head <= existing.tail && existing.tail <= existing.capacity;
+        if (valid) {
+            reuse = true;
+            m_capacity = std::max<size_t>(m_capacity, existing.capacity);
+        } else {
+            // Keep the old file for inspection rather than replaying rows of another layout
+            std::string aside = path + ".incompatible";
+            LOG_ERROR("Spool " << path << " has an unknown layout, moved to " << aside);
+            ::close(m_fd);
+            if (std::rename(path.c_str(), aside.c_str()) != 0) {
+                throw std::runtime_error("Failed to move incompatible spool: " + path);
+            }
+            m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (m_fd == -1) {
+                throw std::runtime_error("Failed to open spool: " + path);
+            }
+        }
+    }
+
+    // The file is sparse; blocks are only allocated as rows are spooled
+    m_mappedSize = HEADER_SIZE + m_capacity * sizeof(Record);
+    if (::ftruncate(m_fd, static_cast<off_t>(m_mappedSize)) != 0) {
+        ::close(m_fd);
+        throw std::runtime_error("Failed to size spool: " + path);
+    }
+
+    void* base = ::mmap(nullptr, m_mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (base == MAP_FAILED) {
+        ::close(m_fd);
+        throw std::runtime_error("Failed to map spool: " + path);
+    }
+    m_header = static_cast<Header*>(base);
+    m_records = reinterpret_cast<Record*>(static_cast<char*>(base) + HEADER_SIZE);
+
+    if (!reuse) {
+        std::memcpy(m_header->magic, SPOOL_MAGIC, sizeof(SPOOL_MAGIC));
+        m_header->recordSize = sizeof(Record);
+        m_header->reserved = 0;
+        m_header->head = 0;
+        m_header->tail = 0;
+    }
+    m_header->capacity = m_capacity;
+    m_peekEnd = m_header->head;
+    m_dirty = true;
+
+    if (pending() > 0) {
+        LOG_INFO("Spool " << path << " holds " << pending() << " rows from a previous run");
+    }
+}
+
+Spool::~Spool() {
+    if (m_header != nullptr) {
+        ::msync(m_header, m_mappedSize, MS_SYNC);
+        ::munmap(m_header, m_mappedSize);
+    }
+    if (m_fd != -1) {
+        ::close(m_fd);
+    }
+}
+
+size_t Spool::pending() const {
+    return static_cast<size_t>(m_header->tail - m_header->head);
+}
+
+bool Spool::append(const Snapshot& snapshot) {
+    if (m_header->tail >= m_capacity) {
+        compact();
+        if (m_header->tail >= m_capacity) {
+            ++m_dropped;
+            return false;
+        }
+    }
+
+    // The row is complete before the tail moves past it
+    Record& record = m_records[m_header->tail];
+    std::memcpy(&record.data, &snapshot, sizeof(Snapshot));
+    record.reserved = 0;
+    record.checksum = recordChecksum(record.data);
+    m_header->tail = m_header->tail + 1;
+    m_dirty = true;
+    return true;
+}
+
+// Move the unreplayed rows to the front to make room at the tail
+void Spool::compact() {
+    uint64_t head = m_header->head;
+    if (head == 0) {
+        return;
+    }
+    uint64_t count = m_header->tail - head;
+    std::memmove(m_records, m_records + head, count * sizeof(Record));
+    m_header->head = 0;
+    m_header->tail = count;
+    m_peekEnd = m_peekEnd > head ? m_peekEnd - head : 0;
+    m_dirty = true;
+}
+
+size_t Spool::peek(Snapshot* out, size_t maxRows) {
+    uint64_t position = m_header->head;
+    size_t count = 0;
+    while (position < m_header->tail && count < maxRows) {
+        const Record& record = m_records[position++];
+        if (record.checksum != recordChecksum(record.data)) {
+            ++m_corrupt;
+            continue;
+        }
+        out[count++] = record.data;
+    }
+    m_peekEnd = position;
+    return count;
+}
+
+void Spool::consume() {
+    m_header->head = std::min<uint64_t>(m_peekEnd, m_header->tail);
+    if (m_header->head == m_header->tail) {
+        // Fully replayed; start again from the front of the file
+        m_header->head = 0;
+        m_header->tail = 0;
+    }
+    m_peekEnd = m_header->head;
+    m_dirty = true;
+}
+
+void Spool::sync(std::chrono::milliseconds interval) {
+    auto now = std::chrono::steady_clock::now();
+    if (!m_dirty || now - m_lastSync < interval) {
+        return;
+    }
+    if (::msync(m_header, m_mappedSize, MS_SYNC) != 0) {
+        LOG_ERROR("Failed to sync spool: " << m_path);
+    }
+    m_dirty = false;
+    m_lastSync = now;
+}
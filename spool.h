@@ -0,0 +1,63 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include "snapshot.h"
+
+// Append-only, memory-mapped file of snapshots that could not be written to
+// the database. Rows are appended at the tail and replayed from the head;
+// both positions live in the mapped header, so whatever was spooled before a
+// crash or restart is found again when the file is reopened. Once every row
+// has been replayed the file is reset to empty.
+//
+// Not thread-safe; owned by the writer thread.
+class Spool {
+public:
+    // Opens or creates the spool at path, sized for capacityRows rows; throws on failure
+    Spool(const std::string& path, size_t capacityRows);
+    ~Spool();
+
+    Spool(const Spool&) = delete;
+    Spool& operator=(const Spool&) = delete;
+
+    // False when the spool is full; the row is counted as dropped
+    bool append(const Snapshot& snapshot);
+
+    // Copy up to maxRows of the oldest rows without removing them. Rows that
+    // fail their checksum are skipped and counted as corrupt.
+    size_t peek(Snapshot* out, size_t maxRows);
+    // Remove the rows returned by the last peek()
+    void consume();
+
+    size_t pending() const;
+    size_t capacity() const { return m_capacity; }
+    uint64_t dropped() const { return m_dropped; }
+    uint64_t corrupt() const { return m_corrupt; }
+
+    // Write dirty pages back to disk at most once per interval
+    void sync(std::chrono::milliseconds interval);
+
+private:
+    struct Header;
+    struct Record;
+
+    void compact();
+
+    std::string m_path;
+    int m_fd;
+    size_t m_capacity;
+    size_t m_mappedSize;
+    Header* m_header;
+    Record* m_records;
+
+    uint64_t m_peekEnd;         ///< Head position after the last peek()
+    uint64_t m_dropped;
+    uint64_t m_corrupt;
+    bool m_dirty;
+    std::chrono::steady_clock::time_point m_lastSync;
+};
+
+#endif // SPOOL_H
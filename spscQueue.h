@@ -0,0 +1,93 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounded lock-free ring buffer for exactly one producer thread and one
+// consumer thread. A push into a full queue fails and is counted as an
+// overflow instead of blocking the producer.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity)
+        : m_slots(roundUpToPowerOfTwo(capacity))
+        , m_mask(m_slots.size() - 1) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer side
+    bool tryPush(const T& item) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cachedHead >= m_slots.size()) {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if (tail - m_cachedHead >= m_slots.size()) {
+                m_overflows.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+
+        m_slots[tail & m_mask] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        m_pushed.fetch_add(1, std::memory_order_relaxed);
+
+        size_t depth = tail + 1 - m_cachedHead;
+        if (depth > m_highWater.load(std::memory_order_relaxed)) {
+            m_highWater.store(depth, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // Consumer side
+    bool tryPop(T& item) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cachedTail) {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cachedTail) {
+                return false;
+            }
+        }
+
+        item = m_slots[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Safe to call from any thread; approximate while both sides are active
+    size_t depth() const {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+    size_t capacity() const { return m_slots.size(); }
+    size_t highWaterMark() const { return m_highWater.load(std::memory_order_relaxed); }
+    uint64_t pushedCount() const { return m_pushed.load(std::memory_order_relaxed); }
+    uint64_t overflowCount() const { return m_overflows.load(std::memory_order_relaxed); }
+
+private:
+    static size_t roundUpToPowerOfTwo(size_t value) {
+        size_t size = 2;
+        while (size < value) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    std::vector<T> m_slots;
+    const size_t m_mask;
+
+    // Consumer-owned index and its view of the producer
+    alignas(64) std::atomic<size_t> m_head{0};
+    size_t m_cachedTail = 0;
+
+    // Producer-owned index and its view of the consumer
+    alignas(64) std::atomic<size_t> m_tail{0};
+    size_t m_cachedHead = 0;
+
+    alignas(64) std::atomic<uint64_t> m_pushed{0};
+    std::atomic<uint64_t> m_overflows{0};
+    std::atomic<size_t> m_highWater{0};
+};
+
+#endif // SPSC_QUEUE_H
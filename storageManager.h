@@ -4,30 +4,41 @@
 #include <string>
 #include <vector>
 #include <mariadb/mysql.h>
+#include "dbConnection.h"
+#include "columnArchive.h"
+#include "partitionReader.h"
 
 class StorageManager {
 public:
     StorageManager(const std::string& dbHost, const std::string& dbUser, const std::string& dbPass, const std::string& dbName);
     ~StorageManager();
 
-    // Main method to handle data reduction
-    void reduceStorage(const std::string& outputFolder);
+    // Archive each partition to outputFolder and drop it, with its rollup partitions
+    void archivePartitions(const std::vector<std::string>& partitions, const std::string& outputFolder);
 
-    bool checkDiskUsage();
-    double GetMaxStorage();
+    // Partitions archived in parallel by reduceStorage(); 1 exports them one at a time
+    void setArchiveConcurrency(size_t concurrency);
+    void setArchiveFormat(ArchiveFormat format);
+    // Chunk size and read budget of exports. By default partitions are read in
+    // chunks of 20000 rows by primary key; chunkRows = 0 streams the partition
+    // in one SELECT.
+    void setExportOptions(const ExportOptions& options);
 
 private:
     MYSQL* conn; // Database connection
+    DbConfig dbConfig;
+    size_t archiveConcurrency;
+    ArchiveFormat archiveFormat;
+    ExportOptions exportOptions;
 
     // Helper methods
-    std::vector<std::string> getOldestPartitions(int count);
-    std::vector<std::string> getFoldersInDirectory(const std::string& directory);
     void exportPartitionToCSV(const std::string& partitionName, const std::string& outputFolder);
+    void exportPartitionColumnar(const std::string& partitionName, const std::string& outputFolder);
     void deletePartition(const std::string& partitionName);
+    void dropRollupPartitions(const std::string& partitionName);
     
     void connect();
     void disconnect();
-    int GetDeletionAmount();
 };
 
 void createDirectory(const std::string& path);
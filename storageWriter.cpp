@@ -0,0 +1,397 @@
+#include "storageWriter.h"
+#include "logger.h"
+#include "metrics.h"
+#include <cstdint>
+#include <algorithm>
+#include <mariadb/errmsg.h>
+#include <sys/socket.h>
+
+namespace {
+// How long the writer thread waits on the queue or the database socket when there is nothing to do
+constexpr auto WRITER_IDLE_SLEEP = std::chrono::milliseconds(5);
+// Minimum time between queue overflow warnings
+constexpr auto OVERFLOW_REPORT_INTERVAL = std::chrono::seconds(10);
+// Ask for partition maintenance once the horizon is closer than this
+constexpr std::time_t PARTITION_HORIZON_MARGIN = 24 * 60 * 60;
+// How often spooled rows are written back to disk
+constexpr auto SPOOL_SYNC_INTERVAL = std::chrono::seconds(1);
+// Live rows go to the spool while the queue is more than this full
+constexpr size_t SPOOL_DIVERT_FRACTION = 2;
+// Replay only while the live queue is shorter than 1/REPLAY_QUEUE_FRACTION
+constexpr size_t REPLAY_QUEUE_FRACTION = 4;
+// At most one replay batch per interval, keeping replay below ~10k rows/s
+constexpr size_t REPLAY_BATCH_ROWS = 1000;
+constexpr auto REPLAY_INTERVAL = std::chrono::milliseconds(100);
+// A replay batch rejected this often by a reachable server is dropped
+constexpr int REPLAY_MAX_ATTEMPTS = 3;
+// Reconnect backoff
+constexpr auto RECONNECT_DELAY_MIN = std::chrono::milliseconds(1000);
+constexpr auto RECONNECT_DELAY_MAX = std::chrono::milliseconds(30000);
+// On shutdown, a database call still in flight after this long is abandoned and its rows spooled
+constexpr auto SHUTDOWN_DEADLINE = std::chrono::seconds(10);
+
+// Replay batches are limited by row count only
+FlushPolicy replayPolicy() {
+    FlushPolicy policy;
+    policy.maxRows = REPLAY_BATCH_ROWS;
+    policy.maxBytes = SIZE_MAX;
+    return policy;
+}
+}
+
+StorageWriter::StorageWriter(const DbConfig& dbConfig, const std::string& tableName, const FlushPolicy& policy,
+                             size_t queueCapacity, const std::string& spoolPath, size_t spoolCapacityRows,
+                             PartitionMaintainer& partitions, const std::atomic<std::time_t>& partitionHorizon)
+    : m_dbConfig(dbConfig)
+    , m_tableName(tableName)
+    , m_policy(policy)
+    , m_partitions(partitions)
+    , m_partitionHorizon(partitionHorizon)
+    , m_conn(NULL)
+    , m_connectResult(NULL)
+    , m_filling(0)
+    , m_writing(0)
+    , m_writeRows(0)
+    , m_operation(Operation::None)
+    , m_replayRows(0)
+    , m_replayFailures(0)
+    , m_dbHealthy(false)
+    , m_reconnectDelay(RECONNECT_DELAY_MIN)
+    , m_queue(queueCapacity)
+    , m_running(false) {
+    try {
+        m_spool = std::make_unique<Spool>(spoolPath, spoolCapacityRows);
+        m_replayBuffer.resize(REPLAY_BATCH_ROWS);
+    } catch (const std::exception& e) {
+        LOG_ERROR(e.what() << ", rows will be lost while the database is unavailable");
+    }
+
+    // The writer thread connects first thing; rows wait in the queue meanwhile
+    m_nextReconnect = std::chrono::steady_clock::now();
+    m_running = true;
+    m_thread = std::thread(&StorageWriter::run, this);
+}
+
+StorageWriter::~StorageWriter() {
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    closeConnection();
+    m_spool.reset();
+}
+
+bool StorageWriter::enqueue(const Snapshot& snapshot) {
+    return m_queue.tryPush(QueuedRow{snapshot, std::chrono::steady_clock::now()});
+}
+
+StorageWriter::QueueStats StorageWriter::queueStats() const {
+    QueueStats stats;
+    stats.depth = m_queue.depth();
+    stats.capacity = m_queue.capacity();
+    stats.highWaterMark = m_queue.highWaterMark();
+    stats.queued = m_queue.pushedCount();
+    stats.overflows = m_queue.overflowCount();
+    return stats;
+}
+
+// Take the status of a _start or _cont call: wait on the socket for it, or
+// act on the result once the current operation has finished
+void StorageWriter::advance(int status) {
+    if (status != 0) {
+        m_wait.set(m_conn, status);
+        return;
+    }
+    Operation finished = m_operation;
+    m_operation = Operation::None;
+    switch (finished) {
+        case Operation::None:
+            break;
+        case Operation::Connect:
+            connectFinished();
+            break;
+        case Operation::Write:
+            writeFinished();
+            break;
+        case Operation::Replay:
+            replayFinished();
+            break;
+    }
+}
+
+// Check the connection after a failure, opening a new one if it is gone
+void StorageWriter::reconnect() {
+    if (m_conn != NULL) {
+        // Still connected; the failure was a rejected batch, e.g. a missing partition
+        databaseAvailable();
+        return;
+    }
+    m_operation = Operation::Connect;
+    advance(startConnection(m_dbConfig, m_conn, m_connectResult));
+}
+
+void StorageWriter::connectFinished() {
+    if (m_connectResult == NULL) {
+        if (m_conn != NULL) {
+            LOG_ERROR("mysql_real_connect() failed: " << mysql_error(m_conn));
+        }
+        closeConnection();
+        connectionFailed(CR_CONNECTION_ERROR);
+        return;
+    }
+    for (auto& batch : m_batches) {
+        batch = std::make_unique<BatchWriter>(m_conn, m_tableName, m_policy);
+    }
+    m_filling = 0;
+    m_replayWriter = std::make_unique<BatchWriter>(m_conn, m_tableName, replayPolicy());
+    databaseAvailable();
+}
+
+void StorageWriter::databaseAvailable() {
+    if (m_spool) {
+        LOG_INFO("Database available, " << m_spool->pending() << " spooled rows to replay");
+    } else {
+        LOG_INFO("Database available");
+    }
+    m_dbHealthy = true;
+    m_reconnectDelay = RECONNECT_DELAY_MIN;
+}
+
+// Send the batch being filled and start filling the other one, nudging
+// partition maintenance if the horizon is getting close
+void StorageWriter::startWrite() {
+    if (std::time(nullptr) + PARTITION_HORIZON_MARGIN >= m_partitionHorizon.load()) {
+        m_partitions.requestRun();
+    }
+    m_writing = m_filling;
+    m_filling = 1 - m_filling;
+    m_writeRows = m_batches[m_writing]->pending();
+    m_writeStarted = std::chrono::steady_clock::now();
+    m_operation = Operation::Write;
+    advance(m_batches[m_writing]->startFlush());
+}
+
+// Rows of a failed batch go to the spool
+void StorageWriter::writeFinished() {
+    PipelineMetrics& metrics = pipelineMetrics();
+    metrics.insert.record(std::chrono::steady_clock::now() - m_writeStarted);
+    BatchWriter& batch = *m_batches[m_writing];
+    if (batch.lastError() == 0) {
+        metrics.rowsInserted.add(m_writeRows);
+        return;
+    }
+
+    metrics.insertFailures.add();
+    batch.takeRows([this](const Snapshot& snapshot) { spoolRow(snapshot); });
+    connectionFailed(batch.lastError());
+}
+
+// Stop writing to the database until reconnect() finds it healthy again.
+// A lost connection is closed; one that is still up is kept and the
+// partitions checked, as a refused batch is usually a missing partition.
+void StorageWriter::connectionFailed(unsigned int error) {
+    if (m_dbHealthy) {
+        LOG_ERROR("Database write failed, spooling rows until it recovers");
+    }
+    if (connectionLost(error)) {
+        closeConnection();
+    } else {
+        for (auto& batch : m_batches) {
+            batch->takeRows([this](const Snapshot& snapshot) { spoolRow(snapshot); });
+        }
+        m_partitions.requestRun();
+    }
+    m_dbHealthy = false;
+    m_nextReconnect = std::chrono::steady_clock::now() + m_reconnectDelay;
+    m_reconnectDelay = std::min(m_reconnectDelay * 2, RECONNECT_DELAY_MAX);
+}
+
+// Drop the connection, spooling rows still waiting in its batches
+void StorageWriter::closeConnection() {
+    for (auto& batch : m_batches) {
+        if (batch) {
+            batch->takeRows([this](const Snapshot& snapshot) { spoolRow(snapshot); });
+            batch.reset();
+        }
+    }
+    m_replayWriter.reset();
+    if (m_conn != NULL) {
+        mysql_close(m_conn);
+        m_conn = NULL;
+    }
+    m_operation = Operation::None;
+}
+
+// Give up on the call in flight: shut the socket down first, so that closing
+// the statement and the connection fail at once instead of waiting on the
+// server, then spool the rows of both batches
+void StorageWriter::abandonOperation() {
+    LOG_ERROR("Database call still running at shutdown, abandoning it and spooling its rows");
+    if (m_conn != NULL) {
+        ::shutdown(mysql_get_socket(m_conn), SHUT_RDWR);
+    }
+    closeConnection();
+    m_dbHealthy = false;
+}
+
+void StorageWriter::spoolRow(const Snapshot& snapshot) {
+    if (!m_spool) {
+        LOG_ERROR_LIMITED("No database connection, row not stored. Timestamp: " << snapshot.timestampMs);
+        return;
+    }
+    if (m_spool->append(snapshot)) {
+        pipelineMetrics().rowsSpooled.add();
+    } else if (m_spool->dropped() % 1000 == 1) {
+        LOG_ERROR("Spool full, " << m_spool->dropped() << " rows dropped");
+    }
+}
+
+// Start writing back one batch of spooled rows when the database has time for it
+void StorageWriter::replaySpool() {
+    if (!m_spool || m_spool->pending() == 0) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now < m_nextReplay || m_queue.depth() > m_queue.capacity() / REPLAY_QUEUE_FRACTION) {
+        return;
+    }
+    m_nextReplay = now + REPLAY_INTERVAL;
+
+    m_replayRows = m_spool->peek(m_replayBuffer.data(), m_replayBuffer.size());
+    for (size_t i = 0; i < m_replayRows; ++i) {
+        m_replayWriter->append(m_replayBuffer[i]);
+    }
+    m_operation = Operation::Replay;
+    advance(m_replayWriter->startFlush());
+}
+
+void StorageWriter::replayFinished() {
+    unsigned int error = m_replayWriter->lastError();
+    if (error == 0) {
+        pipelineMetrics().rowsInserted.add(m_replayRows);
+        m_spool->consume();
+        m_replayFailures = 0;
+        if (m_spool->pending() == 0) {
+            LOG_INFO("Spool replay complete");
+        }
+        return;
+    }
+
+    m_replayWriter->takeRows([](const Snapshot&) {});
+    if (!connectionLost(error) && ++m_replayFailures >= REPLAY_MAX_ATTEMPTS) {
+        // The server is up but keeps refusing these rows; don't let them block the rest
+        LOG_ERROR("Dropping " << m_replayRows << " spooled rows rejected " << m_replayFailures << " times");
+        m_spool->consume();
+        m_replayFailures = 0;
+        return;
+    }
+    connectionFailed(error);
+}
+
+// Writer thread: drain queued snapshots into batches and drive the database
+// calls until stopped. While the database is failing, or the queue is
+// backing up behind slow writes, rows go to the spool instead.
+void StorageWriter::run() {
+    QueuedRow queued;
+    uint64_t reportedOverflows = 0;
+    auto lastReport = std::chrono::steady_clock::now();
+    auto shutdownDeadline = std::chrono::steady_clock::time_point::max();
+
+    while (true) {
+        // Read the flag before draining so rows queued before shutdown are still written
+        bool stopping = !m_running.load();
+        if (stopping && shutdownDeadline == std::chrono::steady_clock::time_point::max()) {
+            shutdownDeadline = std::chrono::steady_clock::now() + SHUTDOWN_DEADLINE;
+        }
+
+        if (stopping && m_operation == Operation::Connect) {
+            closeConnection();
+        } else if (m_operation != Operation::None && std::chrono::steady_clock::now() >= shutdownDeadline) {
+            // A server stalled mid-flush must not hold up shutdown
+            abandonOperation();
+        }
+        if (!m_dbHealthy && m_operation == Operation::None && !stopping &&
+            std::chrono::steady_clock::now() >= m_nextReconnect) {
+            reconnect();
+        }
+
+        // Rows wait in the queue while a connection is being opened, and
+        // while both batches are busy
+        bool divert = (!m_dbHealthy && m_operation != Operation::Connect) ||
+                      (m_spool && m_queue.depth() > m_queue.capacity() / SPOOL_DIVERT_FRACTION);
+        bool blocked = false;
+        size_t drained = 0;
+        while (true) {
+            BatchWriter* batch = m_dbHealthy ? m_batches[m_filling].get() : nullptr;
+            if (!divert && (batch == nullptr || batch->full())) {
+                blocked = true;
+                break;
+            }
+            if (!m_queue.tryPop(queued)) {
+                break;
+            }
+            ++drained;
+            pipelineMetrics().queueWait.record(std::chrono::steady_clock::now() - queued.queuedAt);
+            if (divert) {
+                spoolRow(queued.snapshot);
+                continue;
+            }
+            batch->append(queued.snapshot);
+            if (batch->due() && m_operation == Operation::None) {
+                startWrite();
+            }
+        }
+
+        if (m_dbHealthy && m_operation == Operation::None) {
+            BatchWriter& batch = *m_batches[m_filling];
+            if (batch.due() || (stopping && batch.pending() > 0)) {
+                startWrite();
+            } else if (!stopping) {
+                replaySpool();
+            }
+        }
+        if (m_spool) {
+            m_spool->sync(SPOOL_SYNC_INTERVAL);
+        }
+        if (stopping && m_operation == Operation::None && m_queue.depth() == 0 &&
+            (!m_dbHealthy || m_batches[m_filling]->pending() == 0)) {
+            break;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        uint64_t overflows = m_queue.overflowCount();
+        if (overflows != reportedOverflows && now - lastReport >= OVERFLOW_REPORT_INTERVAL) {
+            LOG_WARNING("Writer falling behind: " << (overflows - reportedOverflows)
+                        << " rows dropped, queue depth " << m_queue.depth()
+                        << "/" << m_queue.capacity());
+            reportedOverflows = overflows;
+            lastReport = now;
+        }
+
+        // Wait on the socket while a call is in flight, for no longer than
+        // the queue would wait
+        auto idle = drained == 0 || blocked ? WRITER_IDLE_SLEEP : std::chrono::milliseconds(0);
+        if (m_operation != Operation::None) {
+            int events = m_wait.wait(m_conn, idle);
+            if (events != 0) {
+                int status = 0;
+                switch (m_operation) {
+                    case Operation::None:
+                        break;
+                    case Operation::Connect:
+                        status = mysql_real_connect_cont(&m_connectResult, m_conn, events);
+                        break;
+                    case Operation::Write:
+                        status = m_batches[m_writing]->continueFlush(events);
+                        break;
+                    case Operation::Replay:
+                        status = m_replayWriter->continueFlush(events);
+                        break;
+                }
+                advance(status);
+            }
+        } else if (drained == 0) {
+            std::this_thread::sleep_for(idle);
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef STORAGE_WRITER_H
+#define STORAGE_WRITER_H
+
+#include <string>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <ctime>
+#include <mariadb/mysql.h>
+#include "snapshot.h"
+#include "batchWriter.h"
+#include "spscQueue.h"
+#include "dbConnection.h"
+#include "partitionMaintainer.h"
+#include "spool.h"
+#include "flushPolicy.h"
+
+// One writer thread with its own connection, batches and spool. Rows are
+// queued from the receive thread and written in batches; rows the database
+// cannot take are spooled and replayed once it is healthy again.
+//
+// The thread runs an event loop over the non-blocking client API: while one
+// batch is in flight the next one is filled, and connecting after a failure
+// happens in the same loop, so nothing it does waits on the server.
+class StorageWriter {
+public:
+    // Health of the hand-off between the receive thread and the writer thread
+    struct QueueStats {
+        size_t depth;
+        size_t capacity;
+        size_t highWaterMark;
+        uint64_t queued;
+        uint64_t overflows;
+    };
+
+    // partitions and partitionHorizon are shared with the other writers of the table
+    StorageWriter(const DbConfig& dbConfig, const std::string& tableName, const FlushPolicy& policy,
+                  size_t queueCapacity, const std::string& spoolPath, size_t spoolCapacityRows,
+                  PartitionMaintainer& partitions, const std::atomic<std::time_t>& partitionHorizon);
+    // Writes any queued rows before returning; a database call that has not
+    // finished within a few seconds is abandoned and its rows spooled
+    ~StorageWriter();
+
+    StorageWriter(const StorageWriter&) = delete;
+    StorageWriter& operator=(const StorageWriter&) = delete;
+
+    // Never waits for the database; a full queue drops the row and counts it
+    bool enqueue(const Snapshot& snapshot);
+    QueueStats queueStats() const;
+
+private:
+    // A row with the time it was queued
+    struct QueuedRow {
+        Snapshot snapshot;
+        std::chrono::steady_clock::time_point queuedAt;
+    };
+
+    // Client work the writer thread is waiting on; at most one at a time
+    enum class Operation { None, Connect, Write, Replay };
+
+    void run();
+    void advance(int status);
+    void reconnect();
+    void connectFinished();
+    void databaseAvailable();
+    void startWrite();
+    void writeFinished();
+    void replaySpool();
+    void replayFinished();
+    void connectionFailed(unsigned int error);
+    void closeConnection();
+    void abandonOperation();
+    void spoolRow(const Snapshot& snapshot);
+
+    DbConfig m_dbConfig;
+    std::string m_tableName;
+    FlushPolicy m_policy;
+    PartitionMaintainer& m_partitions;
+    const std::atomic<std::time_t>& m_partitionHorizon;
+
+    // Database connection, owned by the writer thread. Rows are appended to
+    // m_batches[m_filling] while the other batch may be in flight.
+    MYSQL* m_conn;
+    MYSQL* m_connectResult;
+    std::unique_ptr<BatchWriter> m_batches[2];
+    size_t m_filling;
+    size_t m_writing;
+    size_t m_writeRows;
+    std::chrono::steady_clock::time_point m_writeStarted;
+    Operation m_operation;
+    SocketWait m_wait;
+
+    // Rows the database could not take are kept here and replayed, a batch
+    // at a time, once it is healthy and the live queue is short
+    std::unique_ptr<Spool> m_spool;
+    std::unique_ptr<BatchWriter> m_replayWriter;
+    std::vector<Snapshot> m_replayBuffer;
+    size_t m_replayRows;
+    int m_replayFailures;
+
+    // Writer-thread view of the database; while unhealthy every row is spooled
+    bool m_dbHealthy;
+    std::chrono::milliseconds m_reconnectDelay;
+    std::chrono::steady_clock::time_point m_nextReconnect;
+    std::chrono::steady_clock::time_point m_nextReplay;
+
+    // Snapshots travel from the receive thread to the writer thread through
+    // this queue; only the writer thread touches m_conn once it is running.
+    SpscQueue<QueuedRow> m_queue;
+    std::thread m_thread;
+    std::atomic<bool> m_running;
+};
+
+#endif // STORAGE_WRITER_H
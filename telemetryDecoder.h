@@ -0,0 +1,97 @@
+#ifndef TELEMETRY_DECODER_H
+#define TELEMETRY_DECODER_H
+
+#include <msgpack.hpp>
+#include <algorithm>
+#include "msgpackFields.h"
+#include "snapshot.h"
+
+// Decoders expanded from TELEMETRY_FIELDS. Each commandID gets its own
+// instantiation that only compares the keys belonging to that message.
+
+inline bool readField(const msgpack::object& value, uint32_t& out) {
+    return readUint(value, out);
+}
+
+inline bool readField(const msgpack::object& value, TelemetryString& out) {
+    if (value.type != msgpack::type::STR) {
+        return false;
+    }
+    out.assign(value.via.str.ptr, value.via.str.size);
+    return true;
+}
+
+// Copy every recognised key of one message type into the snapshot. Missing
+// keys and type mismatches leave the previous value in place.
+template <uint16_t Command>
+void decodeFields(const msgpack::object_map& fields, Snapshot& snapshot) {
+    for (uint32_t i = 0; i < fields.size; ++i) {
+        const msgpack::object_kv& kv = fields.ptr[i];
+#define DECODE_FIELD(command, name, type) \
+        if constexpr (command == Command) { \
+            if (keyEquals(kv.key, #name)) { \
+                readField(kv.val, snapshot.name); \
+                continue; \
+            } \
+        }
+        TELEMETRY_FIELDS(DECODE_FIELD)
+#undef DECODE_FIELD
+        (void)kv;
+    }
+}
+
+// Decode a message into the snapshot; false for an unknown commandID
+inline bool decodeMessage(uint16_t commandID, const msgpack::object_map& fields, Snapshot& snapshot) {
+    switch (commandID) {
+#define DECODE_MESSAGE(command) \
+        case command: decodeFields<command>(fields, snapshot); return true;
+        TELEMETRY_MESSAGES(DECODE_MESSAGE)
+#undef DECODE_MESSAGE
+        default:
+            return false;
+    }
+}
+
+// Bit of a message type in a set of received message types; 0 for an unknown commandID
+inline uint32_t telemetryMessageBit(uint16_t commandID) {
+    uint32_t bit = 1;
+#define MESSAGE_BIT(command) \
+    if (commandID == command) { \
+        return bit; \
+    } \
+    bit <<= 1;
+    TELEMETRY_MESSAGES(MESSAGE_BIT)
+#undef MESSAGE_BIT
+    return 0;
+}
+
+// Copy the fields of the message types in messages (telemetryMessageBit()s)
+// from one snapshot to another, keeping the newer timestamp
+inline void mergeMessageFields(uint32_t messages, const Snapshot& from, Snapshot& to) {
+#define MERGE_FIELD(command, name, type) \
+    if (messages & telemetryMessageBit(command)) { \
+        to.name = from.name; \
+    }
+    TELEMETRY_FIELDS(MERGE_FIELD)
+#undef MERGE_FIELD
+    to.timestampMs = std::max(to.timestampMs, from.timestampMs);
+}
+
+// Read the publisher timestamp, in epoch milliseconds. Returns nullptr on
+// success, otherwise why the message has no usable timestamp.
+inline const char* decodeTimestamp(const msgpack::object_map& fields, uint64_t& timestampMs) {
+    const msgpack::object* value = findField(fields, "timestamp");
+    if (value == nullptr) {
+        return "Timestamp key not found";
+    }
+    if (!readUint(*value, timestampMs)) {
+        return "Invalid timestamp type";
+    }
+    // Validate timestamp (optional, but can catch some edge cases)
+    if (timestampMs == 0) {
+        return "Zero timestamp received";
+    }
+    return nullptr;
+}
+
+#endif // TELEMETRY_DECODER_H
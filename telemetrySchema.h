@@ -0,0 +1,96 @@
+#ifndef TELEMETRY_SCHEMA_H
+#define TELEMETRY_SCHEMA_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+// Single definition of every telemetry message and field. The Snapshot row,
+// the msgpack decoders, the INSERT column list and bindings, and the export
+// column order are all expanded from the two tables below, so adding a field
+// is one line in TELEMETRY_FIELDS and adding a message type is one line in
+// TELEMETRY_MESSAGES plus its fields.
+
+constexpr uint16_t PARSE_VERSION = 0x72;
+constexpr uint16_t PARSE_POWER = 0x6B;
+constexpr uint16_t PARSE_LASERHEAD_FLOW = 0x6a;
+constexpr uint16_t PARSE_DC_INFO = 0xD1;
+constexpr uint16_t PARSE_PWM_MODULATION = 0xE8;
+constexpr uint16_t PARSE_RF_INFO = 0xEF;
+constexpr uint16_t PARSE_SYSTEM_INFO = 0xa000;
+
+// Fixed-size string column; the length travels with the row so it can be
+// bound directly for array inserts.
+struct TelemetryString {
+    char data[32];
+    unsigned long length;
+
+    void assign(const char* text, size_t size) {
+        length = size < sizeof(data) - 1 ? size : sizeof(data) - 1;
+        std::memcpy(data, text, length);
+        data[length] = '\0';
+    }
+};
+
+// X(commandID)
+#define TELEMETRY_MESSAGES(X) \
+    X(PARSE_LASERHEAD_FLOW) \
+    X(PARSE_VERSION) \
+    X(PARSE_POWER) \
+    X(PARSE_PWM_MODULATION) \
+    X(PARSE_DC_INFO) \
+    X(PARSE_RF_INFO) \
+    X(PARSE_SYSTEM_INFO)
+
+// X(commandID, field, type) in laser_data column order; type is uint32_t or TelemetryString
+#define TELEMETRY_FIELDS(X) \
+    X(PARSE_LASERHEAD_FLOW, flowRate, uint32_t) \
+    X(PARSE_VERSION, version, TelemetryString) \
+    X(PARSE_POWER, powerReading, uint32_t) \
+    X(PARSE_PWM_MODULATION, frequency, uint32_t) \
+    X(PARSE_PWM_MODULATION, pulseWidth, uint32_t) \
+    X(PARSE_DC_INFO, dcVoltage, uint32_t) \
+    X(PARSE_DC_INFO, dcCurrent, uint32_t) \
+    X(PARSE_RF_INFO, channelAForwardVoltage, uint32_t) \
+    X(PARSE_RF_INFO, channelAReferenceVoltage, uint32_t) \
+    X(PARSE_RF_INFO, channelBForwardVoltage, uint32_t) \
+    X(PARSE_RF_INFO, channelBReferenceVoltage, uint32_t) \
+    X(PARSE_RF_INFO, channelCForwardVoltage, uint32_t) \
+    X(PARSE_RF_INFO, channelCReferenceVoltage, uint32_t) \
+    X(PARSE_RF_INFO, channelDForwardVoltage, uint32_t) \
+    X(PARSE_RF_INFO, channelDReferenceVoltage, uint32_t) \
+    X(PARSE_SYSTEM_INFO, serialNumber, uint32_t) \
+    X(PARSE_SYSTEM_INFO, systemType, uint32_t) \
+    X(PARSE_SYSTEM_INFO, duty, uint32_t) \
+    X(PARSE_SYSTEM_INFO, tubePressure, uint32_t) \
+    X(PARSE_SYSTEM_INFO, wavelength, uint32_t)
+
+// Number of telemetry fields, excluding the timestamp column
+constexpr size_t TELEMETRY_FIELD_COUNT = 0
+#define TELEMETRY_COUNT_FIELD(command, name, type) + 1
+    TELEMETRY_FIELDS(TELEMETRY_COUNT_FIELD);
+#undef TELEMETRY_COUNT_FIELD
+
+// Column names in table order, followed by the timestamp column
+constexpr const char* TELEMETRY_COLUMNS[] = {
+#define TELEMETRY_COLUMN_NAME(command, name, type) #name,
+    TELEMETRY_FIELDS(TELEMETRY_COLUMN_NAME)
+#undef TELEMETRY_COLUMN_NAME
+    "timestamp"
+};
+constexpr size_t TELEMETRY_COLUMN_COUNT = TELEMETRY_FIELD_COUNT + 1;
+
+// "flowRate, version, ..., timestamp"
+inline std::string telemetryColumnList() {
+    std::string columns;
+    for (size_t i = 0; i < TELEMETRY_COLUMN_COUNT; ++i) {
+        if (i > 0) {
+            columns += ", ";
+        }
+        columns += TELEMETRY_COLUMNS[i];
+    }
+    return columns;
+}
+
+#endif // TELEMETRY_SCHEMA_H